@@ -0,0 +1,272 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+// Copyright (C) Norbert Wenzel 2017.
+
+// Measures the export throughput into memory, so the numbers reflect the cost of header creation
+// and write_data_impl and not the file system. Prints one CSV line per case to stdout:
+//   case,container,storage,path,endian,dtype,dimensions,elements,bytes,iterations,seconds,
+//   gb_per_s,ns_per_element
+// storage is the compile-time storage tag of the element type, path the data path actually taken.
+// Usage: write_throughput [min_seconds_per_case]
+
+#include "numpy_data.hpp"
+#include "boost_endian_conversion.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+struct point3f { float x, y, z; };
+struct flagged_point3f { float x, y, z; std::int32_t flag; };
+
+namespace numpy
+{
+namespace data
+{
+
+//contiguous_storage_tag: the struct only consists of its three coefficients
+template<>
+struct array_data_traits<point3f>
+{
+    using value_type = point3f;
+    using scalar_type = float;
+    using pointer_type = const float*;
+    static constexpr std::size_t dimensions = 3;
+
+    static pointer_type access(const point3f &p, const std::size_t idx)
+    {
+        return idx == 0 ? &p.x : (idx == 1 ? &p.y : &p.z);
+    }
+};
+
+//default_storage_tag: the flag is not exported, so each coefficient is written on its own
+template<>
+struct array_data_traits<flagged_point3f>
+{
+    using value_type = flagged_point3f;
+    using scalar_type = float;
+    using pointer_type = const float*;
+    static constexpr std::size_t dimensions = 3;
+
+    static pointer_type access(const flagged_point3f &p, const std::size_t idx)
+    {
+        return idx == 0 ? &p.x : (idx == 1 ? &p.y : &p.z);
+    }
+};
+
+} //namespace data
+} //namespace numpy
+
+namespace
+{
+
+using rte = numpy::data::detail::runtime_byte_order_conversion;
+using sle = numpy::data::detail::little_endian_byte_order;
+using bec = numpy::data::ext::boost_endian_conversion;
+
+//output stream writing into a preallocated buffer
+class memory_sink
+{
+public:
+    explicit memory_sink(std::size_t capacity) : buffer_(new char[capacity]), capacity_(capacity) {}
+
+    memory_sink& write(const char *data, std::streamsize count)
+    {
+        if(position_ + static_cast<std::size_t>(count) > capacity_) { std::abort(); }
+        std::memcpy(buffer_.get() + position_, data, static_cast<std::size_t>(count));
+        position_ += static_cast<std::size_t>(count);
+        return *this;
+    }
+
+    memory_sink& put(char c) { return write(&c, 1); }
+
+    memory_sink& operator<<(const std::string &s)
+    {
+        return write(s.data(), static_cast<std::streamsize>(s.size()));
+    }
+
+    std::streamoff tellp() const { return static_cast<std::streamoff>(position_); }
+    bool good() const { return true; }
+
+    void rewind() { position_ = 0; }
+    std::size_t size() const { return position_; }
+    //read back something depending on the written data, so the writes cannot be optimized away
+    unsigned char last() const { return position_ > 0 ? buffer_[position_ - 1] : 0; }
+
+private:
+    std::unique_ptr<char[]> buffer_;
+    std::size_t capacity_;
+    std::size_t position_ = 0;
+};
+
+//random access iterator visiting every stride-th element, never contiguous at runtime
+template<typename T>
+class strided_iterator : public std::iterator<std::random_access_iterator_tag, T, std::ptrdiff_t,
+                                              const T*, const T&>
+{
+public:
+    strided_iterator(const T *p, std::ptrdiff_t stride) : p_(p), stride_(stride) {}
+
+    const T& operator*() const { return *p_; }
+    strided_iterator& operator++() { p_ += stride_; return *this; }
+    strided_iterator& operator--() { p_ -= stride_; return *this; }
+    strided_iterator operator+(std::ptrdiff_t n) const { return {p_ + n * stride_, stride_}; }
+    strided_iterator operator-(std::ptrdiff_t n) const { return {p_ - n * stride_, stride_}; }
+    std::ptrdiff_t operator-(const strided_iterator &o) const { return (p_ - o.p_) / stride_; }
+    bool operator==(const strided_iterator &o) const { return p_ == o.p_; }
+    bool operator!=(const strided_iterator &o) const { return p_ != o.p_; }
+
+private:
+    const T *p_;
+    std::ptrdiff_t stride_;
+};
+
+struct bench_case
+{
+    const char *name;
+    const char *container;
+    const char *endian;
+};
+
+const char* path_name(numpy::data::data_path path)
+{
+    switch(path)
+    {
+    case numpy::data::data_path::contiguous: return "contiguous";
+    case numpy::data::data_path::per_element: return "per_element";
+    case numpy::data::data_path::per_coefficient: return "per_coefficient";
+    }
+    return "unknown";
+}
+
+double min_seconds = 0.2;
+unsigned sink_checksum = 0;
+
+template<typename EndianConv, typename Iter>
+void run(const bench_case &c, Iter begin, Iter end)
+{
+    using array_data = numpy::data::array_data_traits<typename std::iterator_traits<Iter>::value_type>;
+    using storage = typename numpy::data::detail::storage_layout<
+                                                                typename array_data::value_type,
+                                                                typename array_data::scalar_type,
+                                                                array_data::dimensions>::type;
+    const bool contiguous_tag = std::is_same<storage,
+                                             numpy::data::detail::contiguous_storage_tag>::value;
+
+    const auto elements = static_cast<std::size_t>(std::distance(begin, end));
+    memory_sink sink{elements * sizeof(typename array_data::scalar_type) * array_data::dimensions +
+                     4096};
+
+    //one untimed export to find out which data path is taken, the observer is not used for timing
+    numpy::data::export_statistics stats;
+    numpy::data::write<EndianConv>(sink, stats, begin, end);
+
+    using clock = std::chrono::steady_clock;
+    std::size_t iterations = 0;
+    const auto start = clock::now();
+    std::chrono::duration<double> elapsed{0};
+    do
+    {
+        sink.rewind();
+        numpy::data::write<EndianConv>(sink, begin, end);
+        sink_checksum += sink.last();
+        ++iterations;
+        elapsed = clock::now() - start;
+    } while(elapsed.count() < min_seconds);
+
+    const double seconds = elapsed.count() / iterations;
+    std::cout << c.name << ','
+              << c.container << ','
+              << (contiguous_tag ? "contiguous" : "default") << ','
+              << path_name(stats.last_data_path()) << ','
+              << c.endian << ','
+              << numpy::data::detail::dtype_type_code<typename array_data::scalar_type>()
+              << sizeof(typename array_data::scalar_type) << ','
+              << array_data::dimensions << ','
+              << elements << ','
+              << sink.size() << ','
+              << iterations << ','
+              << seconds << ','
+              << sink.size() / seconds * 1e-9 << ','
+              << seconds * 1e9 / std::max<std::size_t>(elements, 1) << '\n';
+}
+
+template<typename T>
+void bench_containers(std::size_t n)
+{
+    std::vector<T> vec(n, T(1));
+    run<rte>({"container", "vector", "runtime"}, vec.cbegin(), vec.cend());
+
+    std::deque<T> deq(vec.cbegin(), vec.cend());
+    run<rte>({"container", "deque", "runtime"}, deq.cbegin(), deq.cend());
+
+    std::list<T> lst(vec.cbegin(), vec.cend());
+    run<rte>({"container", "list", "runtime"}, lst.cbegin(), lst.cend());
+
+    std::vector<T> wide(2 * n, T(1));
+    const strided_iterator<T> sbegin{wide.data(), 2};
+    run<rte>({"container", "strided", "runtime"}, sbegin, sbegin + static_cast<std::ptrdiff_t>(n));
+}
+
+template<typename T>
+void bench_element_size(std::size_t bytes)
+{
+    const std::vector<T> vec(bytes / sizeof(T), T(1));
+    run<rte>({"element_size", "vector", "runtime"}, vec.cbegin(), vec.cend());
+}
+
+template<typename EndianConv>
+void bench_endianness(const char *name, std::size_t n)
+{
+    const std::vector<double> vec(n, 1.0);
+    run<EndianConv>({"endian", "vector", name}, vec.cbegin(), vec.cend());
+
+    //a single element export is dominated by the header
+    run<EndianConv>({"header_only", "vector", name}, vec.cbegin(), vec.cbegin() + 1);
+}
+
+} //unnamed namespace
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1) { min_seconds = std::atof(argv[1]); }
+
+    static constexpr std::size_t mib = std::size_t{1} << 20;
+
+    std::cout << "case,container,storage,path,endian,dtype,dimensions,elements,bytes,"
+                 "iterations,seconds,gb_per_s,ns_per_element\n";
+
+    bench_containers<std::int32_t>(4 * mib);
+
+    const std::vector<point3f> points(mib, point3f{1, 2, 3});
+    run<rte>({"storage", "vector", "runtime"}, points.cbegin(), points.cend());
+    const std::vector<flagged_point3f> flagged(mib, flagged_point3f{1, 2, 3, 0});
+    run<rte>({"storage", "vector", "runtime"}, flagged.cbegin(), flagged.cend());
+
+    bench_element_size<std::int8_t>(16 * mib);
+    bench_element_size<std::int16_t>(16 * mib);
+    bench_element_size<std::int32_t>(16 * mib);
+    bench_element_size<std::int64_t>(16 * mib);
+    bench_element_size<double>(16 * mib);
+
+    bench_endianness<rte>("runtime", 2 * mib);
+    bench_endianness<sle>("static_little", 2 * mib);
+    bench_endianness<bec>("boost_endian", 2 * mib);
+
+    std::cerr << "checksum " << sink_checksum << '\n';
+    return 0;
+}
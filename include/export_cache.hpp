@@ -0,0 +1,306 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+// Copyright (C) Norbert Wenzel 2017.
+
+#ifndef NUMPY_DATA_EXTENSION_EXPORT_CACHE_HPP
+#define NUMPY_DATA_EXTENSION_EXPORT_CACHE_HPP
+
+#include "numpy_data.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ios>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include <sys/stat.h>
+
+namespace numpy
+{
+namespace data
+{
+namespace ext
+{
+namespace detail
+{
+
+//streaming XXH64 usable as output stream for numpy::data::write. words are read in host byte
+//order, so the digest equals the reference XXH64 on little endian systems only. this does not
+//matter as long as digests are only compared with digests computed on the same machine.
+class xxh64_stream
+{
+public:
+    explicit xxh64_stream(std::uint64_t seed = 0)
+        : seed_(seed),
+          acc_{{seed + prime1 + prime2, seed + prime2, seed, seed - prime1}}
+    {}
+
+    xxh64_stream& write(const char *data, std::streamsize count)
+    {
+        assert(count >= 0);
+        auto p = reinterpret_cast<const unsigned char*>(data);
+        auto remaining = static_cast<std::size_t>(count);
+        total_length_ += remaining;
+
+        //complete a partially filled stripe first
+        if(buffered_ > 0)
+        {
+            const std::size_t fill = std::min(remaining, stripe_size - buffered_);
+            std::memcpy(buffer_ + buffered_, p, fill);
+            buffered_ += fill;
+            p += fill;
+            remaining -= fill;
+            if(buffered_ < stripe_size) { return *this; }
+            consume_stripe(buffer_);
+            buffered_ = 0;
+        }
+
+        //hash whole stripes directly from the input without copying
+        for( ; remaining >= stripe_size; p += stripe_size, remaining -= stripe_size)
+        {
+            consume_stripe(p);
+        }
+
+        std::memcpy(buffer_, p, remaining);
+        buffered_ = remaining;
+        return *this;
+    }
+
+    xxh64_stream& put(char c) { return write(std::addressof(c), 1); }
+
+    xxh64_stream& operator<<(const std::string &s)
+    {
+        return write(s.data(), static_cast<std::streamsize>(s.size()));
+    }
+
+    std::streamoff tellp() const { return static_cast<std::streamoff>(total_length_); }
+
+    bool good() const { return true; }
+
+    std::uint64_t size() const { return total_length_; }
+
+    std::uint64_t digest() const
+    {
+        std::uint64_t h;
+        if(total_length_ >= stripe_size)
+        {
+            h = rotl(acc_[0], 1) + rotl(acc_[1], 7) + rotl(acc_[2], 12) + rotl(acc_[3], 18);
+            for(const auto a : acc_) { h = merge_round(h, a); }
+        }
+        else
+        {
+            h = seed_ + prime5;
+        }
+        h += total_length_;
+
+        const unsigned char *p = buffer_;
+        std::size_t remaining = buffered_;
+        for( ; remaining >= 8; p += 8, remaining -= 8)
+        {
+            h ^= round(0, read<std::uint64_t>(p));
+            h = rotl(h, 27) * prime1 + prime4;
+        }
+        if(remaining >= 4)
+        {
+            h ^= std::uint64_t{read<std::uint32_t>(p)} * prime1;
+            h = rotl(h, 23) * prime2 + prime3;
+            p += 4;
+            remaining -= 4;
+        }
+        for( ; remaining > 0; ++p, --remaining)
+        {
+            h ^= std::uint64_t{*p} * prime5;
+            h = rotl(h, 11) * prime1;
+        }
+
+        //final avalanche
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+        h *= prime3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    static constexpr std::uint64_t prime1 = 11400714785074694791ULL;
+    static constexpr std::uint64_t prime2 = 14029467366897019727ULL;
+    static constexpr std::uint64_t prime3 = 1609587929392839161ULL;
+    static constexpr std::uint64_t prime4 = 9650029242287828579ULL;
+    static constexpr std::uint64_t prime5 = 2870177450012600261ULL;
+    static constexpr std::size_t stripe_size = 32;
+
+    static std::uint64_t rotl(std::uint64_t x, unsigned r) { return (x << r) | (x >> (64 - r)); }
+
+    static std::uint64_t round(std::uint64_t acc, std::uint64_t input)
+    {
+        acc += input * prime2;
+        return rotl(acc, 31) * prime1;
+    }
+
+    static std::uint64_t merge_round(std::uint64_t h, std::uint64_t acc)
+    {
+        h ^= round(0, acc);
+        return h * prime1 + prime4;
+    }
+
+    template<typename T>
+    static T read(const unsigned char *p)
+    {
+        T val;
+        std::memcpy(std::addressof(val), p, sizeof(T));
+        return val;
+    }
+
+    //the four independent lanes allow the compiler to interleave (or vectorize) the multiplies
+    void consume_stripe(const unsigned char *p)
+    {
+        for(std::size_t i = 0; i < acc_.size(); ++i)
+        {
+            acc_[i] = round(acc_[i], read<std::uint64_t>(p + i * 8));
+        }
+    }
+
+    std::uint64_t seed_;
+    std::array<std::uint64_t, 4> acc_;
+    unsigned char buffer_[stripe_size];
+    std::size_t buffered_ = 0;
+    std::uint64_t total_length_ = 0;
+};
+
+//identifies the file written by the last export. if another writer replaces the file, its inode
+//or modification time differs even if the size is the same
+struct file_identity
+{
+    std::uint64_t device;
+    std::uint64_t inode;
+    std::uint64_t size;
+    std::int64_t mtime_sec;
+    std::int64_t mtime_nsec;
+
+    bool operator==(const file_identity &o) const
+    {
+        return device == o.device && inode == o.inode && size == o.size &&
+               mtime_sec == o.mtime_sec && mtime_nsec == o.mtime_nsec;
+    }
+};
+
+//returns false if the file does not exist (any more)
+inline bool identify_file(const std::string &path, file_identity &id)
+{
+    struct stat st;
+    if(::stat(path.c_str(), std::addressof(st)) != 0) { return false; }
+    id.device = static_cast<std::uint64_t>(st.st_dev);
+    id.inode = static_cast<std::uint64_t>(st.st_ino);
+    id.size = static_cast<std::uint64_t>(st.st_size);
+#if defined(__APPLE__)
+    id.mtime_sec = static_cast<std::int64_t>(st.st_mtimespec.tv_sec);
+    id.mtime_nsec = static_cast<std::int64_t>(st.st_mtimespec.tv_nsec);
+#else
+    id.mtime_sec = static_cast<std::int64_t>(st.st_mtim.tv_sec);
+    id.mtime_nsec = static_cast<std::int64_t>(st.st_mtim.tv_nsec);
+#endif
+    return true;
+}
+
+} //namespace detail
+
+//opt-in cache for periodic exports to the same files. every export is first hashed (header and
+//payload, without any I/O) and only written if the content differs from the last export to the
+//same path or if that file is gone or was modified (size, inode or mtime differ) since then. not
+//thread-safe, use one cache per exporting thread.
+class export_cache
+{
+public:
+    //returns true if the file was written and false if the export was skipped
+    template<typename EndianConv = numpy::data::detail::runtime_byte_order_conversion,
+             typename Iter, typename ShapeDesc>
+    bool write(const std::string &path, Iter begin, Iter end, const ShapeDesc &shape,
+               bool fortran_order = false)
+    {
+        detail::xxh64_stream hash;
+        numpy::data::write<EndianConv>(hash, begin, end, shape, fortran_order);
+        if(unchanged(path, hash)) { return false; }
+
+        std::ofstream out{path, std::ios::out | std::ios::binary};
+        if(!out) { throw std::runtime_error("Cannot open NumPy file " + path); }
+        numpy::data::write<EndianConv>(out, begin, end, shape, fortran_order);
+        finish(path, out, hash);
+        return true;
+    }
+
+    template<typename EndianConv = numpy::data::detail::runtime_byte_order_conversion,
+             typename Iter>
+    bool write(const std::string &path, Iter begin, Iter end)
+    {
+        detail::xxh64_stream hash;
+        numpy::data::write<EndianConv>(hash, begin, end);
+        if(unchanged(path, hash)) { return false; }
+
+        std::ofstream out{path, std::ios::out | std::ios::binary};
+        if(!out) { throw std::runtime_error("Cannot open NumPy file " + path); }
+        numpy::data::write<EndianConv>(out, begin, end);
+        finish(path, out, hash);
+        return true;
+    }
+
+    //forces the next export to path to be written
+    void forget(const std::string &path) { entries_.erase(path); }
+
+    void clear() { entries_.clear(); }
+
+private:
+    struct entry
+    {
+        std::uint64_t digest;
+        std::uint64_t size;
+        detail::file_identity file;
+    };
+
+    bool unchanged(const std::string &path, const detail::xxh64_stream &hash) const
+    {
+        const auto it = entries_.find(path);
+        if(it == entries_.end() ||
+           it->second.digest != hash.digest() ||
+           it->second.size != hash.size())
+        {
+            return false;
+        }
+
+        //the file might have been removed, truncated or replaced since the last export
+        detail::file_identity file;
+        return detail::identify_file(path, file) && file == it->second.file;
+    }
+
+    void finish(const std::string &path, std::ofstream &out, const detail::xxh64_stream &hash)
+    {
+        out.close();
+        if(!out)
+        {
+            entries_.erase(path);
+            throw std::runtime_error("Cannot write NumPy file " + path);
+        }
+        detail::file_identity file;
+        if(!detail::identify_file(path, file) || file.size != hash.size())
+        {
+            entries_.erase(path);
+            return;
+        }
+        entries_[path] = entry{hash.digest(), hash.size(), file};
+    }
+
+    std::unordered_map<std::string, entry> entries_;
+};
+
+} //namespace ext
+} //namespace data
+} //namespace numpy
+
+#endif //NUMPY_DATA_EXTENSION_EXPORT_CACHE_HPP
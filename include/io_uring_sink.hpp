@@ -0,0 +1,599 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+// Copyright (C) Norbert Wenzel 2017.
+
+#ifndef NUMPY_DATA_EXTENSION_IO_URING_SINK_HPP
+#define NUMPY_DATA_EXTENSION_IO_URING_SINK_HPP
+
+#include "numpy_data.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <ios>
+#include <limits>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+//io_uring is only available on Linux (kernel headers >= 5.1). everywhere else the sink silently
+//uses blocking pwrite calls
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && \
+    defined(__NR_io_uring_register)
+#define NUMPY_DATA_HAS_IO_URING 1
+#endif
+#endif
+#endif
+
+namespace numpy
+{
+namespace data
+{
+namespace ext
+{
+namespace detail
+{
+
+inline std::system_error errno_error(int error, const char *what)
+{
+    return std::system_error(error, std::generic_category(), what);
+}
+
+inline void pwrite_all(int fd, const char *data, std::size_t length, std::uint64_t offset)
+{
+    while(length > 0)
+    {
+        const auto res = ::pwrite(fd, data, length, static_cast<off_t>(offset));
+        if(res < 0)
+        {
+            if(errno == EINTR) { continue; }
+            throw errno_error(errno, "pwrite failed");
+        }
+        data += res;
+        length -= static_cast<std::size_t>(res);
+        offset += static_cast<std::uint64_t>(res);
+    }
+}
+
+#ifdef NUMPY_DATA_HAS_IO_URING
+
+//minimal io_uring wrapper without liburing. there is exactly one thread submitting and reaping,
+//so only the indices shared with the kernel need atomic access
+class io_uring_queue
+{
+public:
+    io_uring_queue() = default;
+    io_uring_queue(const io_uring_queue&) = delete;
+    io_uring_queue& operator=(const io_uring_queue&) = delete;
+    ~io_uring_queue() { reset(); }
+
+    //returns false if the kernel (or a seccomp filter) refuses to set up a ring
+    bool init(unsigned entries)
+    {
+        io_uring_params params;
+        std::memset(std::addressof(params), 0, sizeof(params));
+        fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, std::addressof(params)));
+        if(fd_ < 0) { return false; }
+
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+        sq_ptr_ = map(sq_size_, IORING_OFF_SQ_RING);
+        cq_ptr_ = map(cq_size_, IORING_OFF_CQ_RING);
+        sqes_ptr_ = map(sqes_size_, IORING_OFF_SQES);
+        if(sq_ptr_ == MAP_FAILED || cq_ptr_ == MAP_FAILED || sqes_ptr_ == MAP_FAILED)
+        {
+            reset();
+            return false;
+        }
+
+        char* const sq = static_cast<char*>(sq_ptr_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqes_ = static_cast<io_uring_sqe*>(sqes_ptr_);
+
+        char* const cq = static_cast<char*>(cq_ptr_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    bool register_buffers(const iovec *buffers, unsigned count)
+    {
+        return ::syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+    }
+
+    //the caller guarantees there are never more writes in flight than ring entries
+    void submit_write_fixed(int fd, const char *data, unsigned length, std::uint64_t offset,
+                            unsigned buffer_index, std::uint64_t user_data)
+    {
+        const unsigned tail = *sq_tail_;
+        const unsigned idx = tail & sq_mask_;
+
+        io_uring_sqe &sqe = sqes_[idx];
+        std::memset(std::addressof(sqe), 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_WRITE_FIXED;
+        sqe.fd = fd;
+        sqe.addr = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(data));
+        sqe.len = length;
+        sqe.off = offset;
+        sqe.buf_index = static_cast<std::uint16_t>(buffer_index);
+        sqe.user_data = user_data;
+
+        sq_array_[idx] = idx;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+        enter(1, 0, 0);
+    }
+
+    //blocks until at least one write completed and returns its completion entry
+    io_uring_cqe wait()
+    {
+        for(;;)
+        {
+            const unsigned head = *cq_head_;
+            if(head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+            {
+                const io_uring_cqe cqe = cqes_[head & cq_mask_];
+                __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+                return cqe;
+            }
+            enter(0, 1, IORING_ENTER_GETEVENTS);
+        }
+    }
+
+    //unmaps and closes the ring, also used if the ring cannot be used after init()
+    void reset()
+    {
+        if(sqes_ptr_ != MAP_FAILED) { ::munmap(sqes_ptr_, sqes_size_); sqes_ptr_ = MAP_FAILED; }
+        if(cq_ptr_ != MAP_FAILED) { ::munmap(cq_ptr_, cq_size_); cq_ptr_ = MAP_FAILED; }
+        if(sq_ptr_ != MAP_FAILED) { ::munmap(sq_ptr_, sq_size_); sq_ptr_ = MAP_FAILED; }
+        if(fd_ >= 0) { ::close(fd_); fd_ = -1; }
+    }
+
+private:
+    void* map(std::size_t size, off_t offset) const
+    {
+        return ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+    }
+
+    void enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        while(::syscall(__NR_io_uring_enter, fd_, to_submit, min_complete, flags, nullptr, 0) < 0)
+        {
+            if(errno != EINTR) { throw errno_error(errno, "io_uring_enter failed"); }
+        }
+    }
+
+    int fd_ = -1;
+    void *sq_ptr_ = MAP_FAILED;
+    void *cq_ptr_ = MAP_FAILED;
+    void *sqes_ptr_ = MAP_FAILED;
+    std::size_t sq_size_ = 0;
+    std::size_t cq_size_ = 0;
+    std::size_t sqes_size_ = 0;
+
+    unsigned *sq_tail_ = nullptr;
+    unsigned *sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    io_uring_sqe *sqes_ = nullptr;
+
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe *cqes_ = nullptr;
+};
+
+#endif //NUMPY_DATA_HAS_IO_URING
+
+} //namespace detail
+
+class io_uring_sink;
+
+//owns the ring and a fixed pool of registered blocks shared by any number of io_uring_sinks, so
+//exporting many files costs a single io_uring_setup and the writes of all files overlap. full
+//blocks are submitted immediately, io_uring_sink::flush() submits a partially filled block
+//without waiting. wait_all() reaps the completions of all files, closing the sinks afterwards does
+//not block any more. if io_uring is not available (old kernel, seccomp, locked memory limit) the
+//blocks are written synchronously with pwrite instead. the writer has to outlive its sinks and
+//all of them have to be used by the same thread.
+class io_uring_writer
+{
+public:
+    explicit io_uring_writer(std::size_t block_size = std::size_t{1} << 20,
+                             unsigned queue_depth = 4,
+                             bool allow_io_uring = true)
+        : block_size_(block_size),
+          storage_(new char[block_size * std::max(queue_depth, 1u)]),
+          blocks_(std::max(queue_depth, 1u))
+    {
+        assert(block_size > 0 && "Need a positive block size.");
+        assert(block_size <= std::numeric_limits<unsigned>::max() &&
+               "io_uring write length is limited to 32 bit.");
+
+        for(std::size_t i = 0; i < blocks_.size(); ++i)
+        {
+            blocks_[i].data = storage_.get() + i * block_size_;
+        }
+
+#ifdef NUMPY_DATA_HAS_IO_URING
+        if(allow_io_uring && ring_.init(static_cast<unsigned>(blocks_.size())))
+        {
+            std::vector<iovec> buffers(blocks_.size());
+            for(std::size_t i = 0; i < blocks_.size(); ++i)
+            {
+                buffers[i].iov_base = blocks_[i].data;
+                buffers[i].iov_len = block_size_;
+            }
+            use_ring_ = ring_.register_buffers(buffers.data(),
+                                               static_cast<unsigned>(buffers.size()));
+            if(!use_ring_) { ring_.reset(); }
+        }
+#else
+        static_cast<void>(allow_io_uring);
+#endif
+    }
+
+    io_uring_writer(const io_uring_writer&) = delete;
+    io_uring_writer& operator=(const io_uring_writer&) = delete;
+
+    ~io_uring_writer()
+    {
+        assert(in_flight_ == 0 && "Close all sinks before destroying their writer.");
+    }
+
+    bool uses_io_uring() const { return use_ring_; }
+
+    //waits until all submitted writes of all sinks are done. failed writes are reported by the
+    //close() of the sink they belong to
+    void wait_all()
+    {
+        while(in_flight_ > 0) { reap_one(); }
+    }
+
+private:
+    friend class io_uring_sink;
+
+    enum class block_state { free, filling, in_flight };
+
+    struct block
+    {
+        char *data = nullptr;
+        std::size_t length = 0;
+        std::size_t written = 0;
+        std::uint64_t offset = 0;
+        block_state state = block_state::free;
+        io_uring_sink *owner = nullptr;
+    };
+
+    std::size_t acquire(io_uring_sink &sink);
+    void release(std::size_t idx);
+    void submit(std::size_t idx, std::uint64_t offset);
+    void finish(std::size_t idx);
+    void abandon();
+
+#ifdef NUMPY_DATA_HAS_IO_URING
+    void submit_ring(std::size_t idx)
+    {
+        block &b = blocks_[idx];
+        ring_.submit_write_fixed(fd_of(b), b.data + b.written,
+                                 static_cast<unsigned>(b.length - b.written),
+                                 b.offset + b.written,
+                                 static_cast<unsigned>(idx), idx);
+    }
+
+    void reap_one();
+
+    detail::io_uring_queue ring_;
+#else
+    void submit_ring(std::size_t) { assert(false && "io_uring not available"); }
+    void reap_one() { assert(false && "io_uring not available"); }
+#endif
+
+    static int fd_of(const block &b);
+
+    bool use_ring_ = false;
+    std::size_t block_size_;
+    std::unique_ptr<char[]> storage_;
+    std::vector<block> blocks_;
+    std::size_t in_flight_ = 0;
+};
+
+//output sink for numpy::data::write() writing one file through the blocks of an io_uring_writer.
+//the sink is lightweight, so many of them can share one writer to export many arrays at once:
+//
+//  io_uring_writer writer;
+//  std::vector<std::unique_ptr<io_uring_sink>> sinks;
+//  for(...) { sinks.emplace_back(new io_uring_sink{writer, path}); write(*sinks.back(), ...);
+//             sinks.back()->flush(); }
+//  writer.wait_all();
+//  for(auto &s : sinks) { s->close(); }
+//
+//constructing the sink with a path only creates a private writer for a single file.
+class io_uring_sink
+{
+public:
+    io_uring_sink(io_uring_writer &writer, const std::string &path)
+        : writer_(std::addressof(writer))
+    {
+        open(path);
+    }
+
+    explicit io_uring_sink(const std::string &path,
+                           std::size_t block_size = std::size_t{1} << 20,
+                           unsigned queue_depth = 4,
+                           bool allow_io_uring = true)
+        : owned_writer_(new io_uring_writer{block_size, queue_depth, allow_io_uring}),
+          writer_(owned_writer_.get())
+    {
+        open(path);
+    }
+
+    io_uring_sink(const io_uring_sink&) = delete;
+    io_uring_sink& operator=(const io_uring_sink&) = delete;
+
+    ~io_uring_sink()
+    {
+        try { close(); }
+        catch(...) {} //destructors must not throw, call close() explicitly to see errors
+    }
+
+    io_uring_sink& write(const char *data, std::streamsize count)
+    {
+        assert(fd_ >= 0);
+        assert(count >= 0);
+        auto remaining = static_cast<std::size_t>(count);
+        while(remaining > 0)
+        {
+            if(current_ == no_block) { current_ = writer_->acquire(*this); }
+            //acquiring a block may have reaped a failed write of this file
+            if(error_) { std::rethrow_exception(error_); }
+
+            io_uring_writer::block &b = writer_->blocks_[current_];
+            const std::size_t chunk = std::min(remaining, writer_->block_size_ - b.length);
+            std::memcpy(b.data + b.length, data, chunk);
+            b.length += chunk;
+            data += chunk;
+            remaining -= chunk;
+            if(b.length == writer_->block_size_) { submit_current(); }
+        }
+        position_ += static_cast<std::streamoff>(count);
+        return *this;
+    }
+
+    io_uring_sink& put(char c) { return write(std::addressof(c), 1); }
+
+    io_uring_sink& operator<<(const std::string &s)
+    {
+        return write(s.data(), static_cast<std::streamsize>(s.size()));
+    }
+
+    std::streamoff tellp() const { return position_; }
+
+    bool good() const { return fd_ >= 0 && !error_; }
+
+    bool uses_io_uring() const { return writer_->uses_io_uring(); }
+
+    //submits the partially filled block without waiting for it to be written
+    void flush()
+    {
+        assert(fd_ >= 0);
+        if(current_ != no_block) { submit_current(); }
+        if(error_) { std::rethrow_exception(error_); }
+    }
+
+    //writes the partially filled block, waits for all writes of this file and closes it. the file
+    //is closed even if a write failed, the first error is rethrown afterwards
+    void close()
+    {
+        if(fd_ < 0) { return; }
+
+        std::exception_ptr error;
+        try
+        {
+            if(current_ != no_block) { submit_current(); }
+            while(in_flight_ > 0) { writer_->reap_one(); }
+        }
+        catch(...) { error = std::current_exception(); }
+        assert(in_flight_ == 0);
+
+        if(!error) { error = error_; }
+        error_ = nullptr;
+
+        const int fd = fd_;
+        fd_ = -1;
+        const bool closed = (::close(fd) == 0);
+        const int close_error = errno;
+
+        if(error) { std::rethrow_exception(error); }
+        if(!closed) { throw detail::errno_error(close_error, "cannot close output file"); }
+    }
+
+private:
+    friend class io_uring_writer;
+
+    static constexpr std::size_t no_block = std::numeric_limits<std::size_t>::max();
+
+    void open(const std::string &path)
+    {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd_ < 0) { throw detail::errno_error(errno, "cannot open output file"); }
+    }
+
+    void submit_current()
+    {
+        assert(current_ != no_block);
+        const std::size_t idx = current_;
+        current_ = no_block;
+        const std::uint64_t offset = file_offset_;
+        file_offset_ += writer_->blocks_[idx].length;
+        writer_->submit(idx, offset);
+    }
+
+    //keeps the first failed write of this file, it is thrown by the next call of this sink
+    void fail(std::exception_ptr error)
+    {
+        if(!error_) { error_ = error; }
+    }
+
+    std::unique_ptr<io_uring_writer> owned_writer_;
+    io_uring_writer *writer_;
+    int fd_ = -1;
+    std::size_t current_ = no_block;
+    std::size_t in_flight_ = 0;
+    std::uint64_t file_offset_ = 0;
+    std::streamoff position_ = 0;
+    std::exception_ptr error_;
+};
+
+inline int io_uring_writer::fd_of(const block &b)
+{
+    return b.owner->fd_;
+}
+
+//returns a block to be filled by sink. if no block is free the completion of any file is awaited
+inline std::size_t io_uring_writer::acquire(io_uring_sink &sink)
+{
+    for(;;)
+    {
+        for(std::size_t i = 0; i < blocks_.size(); ++i)
+        {
+            block &b = blocks_[i];
+            if(b.state == block_state::free)
+            {
+                b.state = block_state::filling;
+                b.owner = std::addressof(sink);
+                b.length = 0;
+                return i;
+            }
+        }
+
+        if(in_flight_ > 0) { reap_one(); continue; }
+
+        //every block is being filled by another sink, write one of them out
+        const auto other = std::find_if(blocks_.begin(), blocks_.end(), [&](const block &b)
+        {
+            return b.state == block_state::filling && b.owner != std::addressof(sink);
+        });
+        assert(other != blocks_.end());
+        other->owner->submit_current();
+    }
+}
+
+inline void io_uring_writer::release(std::size_t idx)
+{
+    block &b = blocks_[idx];
+    b.state = block_state::free;
+    b.owner = nullptr;
+    b.length = 0;
+}
+
+inline void io_uring_writer::submit(std::size_t idx, std::uint64_t offset)
+{
+    block &b = blocks_[idx];
+    assert(b.state == block_state::filling);
+    if(b.length == 0) { release(idx); return; }
+
+    b.offset = offset;
+    b.written = 0;
+    if(!use_ring_)
+    {
+        try { detail::pwrite_all(b.owner->fd_, b.data, b.length, b.offset); }
+        catch(...) { b.owner->fail(std::current_exception()); }
+        release(idx);
+        return;
+    }
+
+    b.state = block_state::in_flight;
+    ++b.owner->in_flight_;
+    ++in_flight_;
+    try { submit_ring(idx); }
+    catch(...)
+    {
+        finish(idx);
+        throw;
+    }
+}
+
+inline void io_uring_writer::finish(std::size_t idx)
+{
+    block &b = blocks_[idx];
+    assert(b.state == block_state::in_flight);
+    --b.owner->in_flight_;
+    --in_flight_;
+    release(idx);
+}
+
+//gives up all writes in flight after the ring itself failed, no completions can be expected
+inline void io_uring_writer::abandon()
+{
+    for(std::size_t i = 0; i < blocks_.size(); ++i)
+    {
+        if(blocks_[i].state == block_state::in_flight) { finish(i); }
+    }
+}
+
+#ifdef NUMPY_DATA_HAS_IO_URING
+//waits for the next completion of any file. a failed write is kept by its sink
+inline void io_uring_writer::reap_one()
+{
+    assert(in_flight_ > 0);
+    io_uring_cqe cqe;
+    try { cqe = ring_.wait(); }
+    catch(...)
+    {
+        abandon();
+        throw;
+    }
+
+    const auto idx = static_cast<std::size_t>(cqe.user_data);
+    block &b = blocks_[idx];
+    if(cqe.res <= 0)
+    {
+        b.owner->fail(std::make_exception_ptr(
+            detail::errno_error(cqe.res < 0 ? -cqe.res : EIO, "io_uring write failed")));
+        finish(idx);
+        return;
+    }
+
+    b.written += static_cast<std::size_t>(cqe.res);
+    if(b.written < b.length)
+    {
+        //short write: resubmit the rest of the block
+        try { submit_ring(idx); }
+        catch(...)
+        {
+            finish(idx);
+            throw;
+        }
+    }
+    else
+    {
+        finish(idx);
+    }
+}
+#endif //NUMPY_DATA_HAS_IO_URING
+
+} //namespace ext
+} //namespace data
+} //namespace numpy
+
+#endif //NUMPY_DATA_EXTENSION_IO_URING_SINK_HPP
@@ -9,7 +9,9 @@
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <iterator>
 #include <limits>
 #include <ostream>
@@ -42,6 +44,10 @@ struct array_data_traits
 
 enum class byte_order { unknown, big_endian, little_endian };
 
+//the way write_data transfers the array data to the output stream: the whole range at once, or
+//collected in a staging buffer element by element or coefficient by coefficient
+enum class data_path { contiguous, per_element, per_coefficient };
+
 namespace detail
 {
 
@@ -241,10 +247,23 @@ std::string create_header_dictionary(bool fortran_order, const ShapeDesc &shape)
 // to signed int8 without narrowing conversion from intermediate integer even on older compilers
 static constexpr std::int8_t magic_header[] = {std::int8_t(0x93), 'N', 'U', 'M', 'P', 'Y'};
 
-template<typename EndianConv, typename Iter, typename OStream, typename ShapeDesc>
-void write_header(OStream &out, const ShapeDesc &shape, bool fortran_order)
+//observer used when the caller does not observe the export. all calls are inlined to nothing
+struct null_observer
 {
-    for(auto c : magic_header) { out.put(c); }
+    void begin_header() {}
+    void end_header() {}
+    void begin_data(data_path) {}
+    void end_data() {}
+    void sink_write(std::size_t) {}
+};
+
+template<typename EndianConv, typename Iter, typename OStream, typename ShapeDesc,
+         typename Observer>
+void write_header(OStream &out, const ShapeDesc &shape, bool fortran_order, Observer &observer)
+{
+    observer.begin_header();
+
+    for(auto c : magic_header) { out.put(c); observer.sink_write(1); }
 
     //fail_print_type<typename array_data_traits<typename std::iterator_traits<Iter>::value_type>::scalar_type>{};
 
@@ -256,23 +275,28 @@ void write_header(OStream &out, const ShapeDesc &shape, bool fortran_order)
                                                 EndianConv
                                             >(fortran_order, shape);
 
-    //determine the numpy data format version (depending on length of header)
-    static constexpr std::uint16_t v1_max_length = std::numeric_limits<std::uint16_t>::max() -
-                                                   std::uint16_t{1};
-    const std::uint8_t format_version = (header_dict.size() >= v1_max_length ? 2 : 1);
+    //compute necessary padding for the header, which depends on the format version
+    const auto padding = [&header_dict](std::uint8_t version) -> std::uint8_t
+    {
+        const std::size_t total_header_length = sizeof(magic_header) +
+                                                2 + //the format version major and minor number
+                                                (version == 1 ? sizeof(std::uint16_t) :
+                                                                sizeof(std::uint32_t)) +
+                                                header_dict.size() + 1; //count newline character
+        return static_cast<std::uint8_t>((16 - (total_header_length % 16)) % 16);
+    };
+
+    //determine the numpy data format version. version 1 stores the length of the header including
+    //padding and newline in 16 bit, so the padding has to be considered for very long headers
+    const std::uint8_t format_version =
+        (header_dict.size() + padding(1) + 1 <= std::numeric_limits<std::uint16_t>::max() ? 1 : 2);
     assert(format_version == 1 || format_version == 2);
 
     //write data format version
     out.put(format_version); out.put(std::uint8_t{0});
+    observer.sink_write(2);
 
-    //compute necessary padding for the header
-    const std::size_t total_header_length = sizeof(magic_header) +
-                                            2 + //the format version major and minor number
-                                            (format_version == 1 ? sizeof(std::uint16_t) :
-                                                                   sizeof(std::uint32_t)) +
-                                            header_dict.size() + 1; //count newline character
-    const std::uint8_t padding_length = static_cast<std::uint8_t>(
-        (16 - (total_header_length % 16)) % 16);
+    const std::uint8_t padding_length = padding(format_version);
     assert(padding_length < 16);
 
     //compute the length of the header (including padding and the newline character)
@@ -286,36 +310,49 @@ void write_header(OStream &out, const ShapeDesc &shape, bool fortran_order)
         assert(header_len <= std::numeric_limits<std::uint16_t>::max());
         std::uint16_t len = EndianConv::to_little_endian(static_cast<std::uint16_t>(header_len));
         out.write(reinterpret_cast<const char*>(std::addressof(len)), sizeof(len));
+        observer.sink_write(sizeof(len));
     }
     else if(format_version == 2)
     {
         assert(header_len <= std::numeric_limits<std::uint32_t>::max());
         std::uint32_t len = EndianConv::to_little_endian(static_cast<std::uint32_t>(header_len));
         out.write(reinterpret_cast<const char*>(std::addressof(len)), sizeof(len));
+        observer.sink_write(sizeof(len));
     }
 
     //write the header
     out << header_dict;
+    observer.sink_write(header_dict.size());
 
     //write spaces as header padding
-    for(std::uint8_t i = 0; i < padding_length; ++i) { out.put(' '); }
+    for(std::uint8_t i = 0; i < padding_length; ++i) { out.put(' '); observer.sink_write(1); }
 
     //write final newline
     out.put('\n');
+    observer.sink_write(1);
 
     //assume we have now written a multiple of 16 characters for the whole header
     assert(out.tellp() % 16 == 0);
+
+    observer.end_header();
 }
 
-template<typename Iter, typename IterCat>
-constexpr bool is_contiguous_impl(Iter, Iter, IterCat)
+template<typename EndianConv, typename Iter, typename OStream, typename ShapeDesc>
+void write_header(OStream &out, const ShapeDesc &shape, bool fortran_order)
+{
+    null_observer observer;
+    write_header<EndianConv, Iter>(out, shape, fortran_order, observer);
+}
+
+template<typename Iter>
+constexpr bool is_contiguous_impl(Iter, Iter, std::false_type)
 {
     //only random access iterators will be checked
     return false;
 }
 
 template<typename RandIter>
-bool is_contiguous_impl(RandIter begin, RandIter end, std::random_access_iterator_tag)
+bool is_contiguous_impl(RandIter begin, RandIter end, std::true_type)
 {
     using std::addressof;
     using std::distance;
@@ -326,11 +363,93 @@ bool is_contiguous_impl(RandIter begin, RandIter end, std::random_access_iterato
 template<typename Iter>
 bool is_contiguous(Iter begin, Iter end)
 {
-    return is_contiguous_impl(begin, end, typename std::iterator_traits<Iter>::iterator_category{});
+    //also accept iterator categories derived from the random access tag (eg. Boost.Iterator)
+    using random_access = std::is_base_of<std::random_access_iterator_tag,
+                                          typename std::iterator_traits<Iter>::iterator_category>;
+    return is_contiguous_impl(begin, end, random_access{});
 }
 
-template<typename OStream, typename Iter>
-void write_data_impl(OStream &out, Iter begin, Iter end, contiguous_storage_tag)
+//ranges that cannot be written at once are collected in a staging buffer of this size, so the
+//output stream is called once per staging_size bytes instead of once per element or coefficient
+static constexpr std::size_t staging_size = 16 * 1024;
+
+template<typename OStream, typename Observer>
+class staging_buffer
+{
+public:
+    staging_buffer(OStream &out, Observer &observer) : out_(out), observer_(observer) {}
+
+    //the size is known at compile time, so the copy compiles to a few moves
+    template<std::size_t N>
+    void append(const char *data)
+    {
+        if(N > staging_size)
+        {
+            //elements larger than the buffer are written directly
+            flush();
+            write(data, N);
+            return;
+        }
+        if(used_ + N > staging_size) { flush(); }
+        std::memcpy(buffer_ + used_, data, N);
+        used_ += N;
+    }
+
+    void flush()
+    {
+        if(used_ > 0) { write(buffer_, used_); }
+        used_ = 0;
+    }
+
+private:
+    void write(const char *data, std::size_t size)
+    {
+        out_.write(data, size);
+        observer_.sink_write(size);
+    }
+
+    OStream &out_;
+    Observer &observer_;
+    std::size_t used_ = 0;
+    char buffer_[staging_size];
+};
+
+//copy kernels for a single element, selected at compile time by the storage layout
+template<typename ArrayData, typename Staging, typename Value>
+void stage_element(Staging &staging, const Value &v, contiguous_storage_tag)
+{
+    //all coefficients are stored next to each other
+    staging.template append<sizeof(typename ArrayData::scalar_type) * ArrayData::dimensions>(
+        reinterpret_cast<const char *>(ArrayData::access(v, 0)));
+}
+
+template<typename ArrayData, typename Staging, typename Value>
+void stage_element(Staging &staging, const Value &v, default_storage_tag)
+{
+    //gather each coefficient on its own
+    for(std::size_t d = 0; d < ArrayData::dimensions; ++d)
+    {
+        staging.template append<sizeof(typename ArrayData::scalar_type)>(
+            reinterpret_cast<const char *>(ArrayData::access(v, d)));
+    }
+}
+
+template<typename OStream, typename Iter, typename StorageTag, typename Observer>
+void write_staged(OStream &out, Iter begin, Iter end, StorageTag tag, Observer &observer)
+{
+    using array_data = array_data_traits<typename std::iterator_traits<Iter>::value_type>;
+
+    staging_buffer<OStream, Observer> staging{out, observer};
+    for( ; begin != end; ++begin)
+    {
+        stage_element<array_data>(staging, *begin, tag);
+    }
+    staging.flush();
+}
+
+template<typename OStream, typename Iter, typename Observer>
+void write_data_impl(OStream &out, Iter begin, Iter end, contiguous_storage_tag tag,
+                     Observer &observer)
 {
     using array_data = array_data_traits<typename std::iterator_traits<Iter>::value_type>;
     using data_type = typename array_data::scalar_type;
@@ -339,45 +458,45 @@ void write_data_impl(OStream &out, Iter begin, Iter end, contiguous_storage_tag)
     //non-contiguous at compile-time
     if(is_contiguous(begin, end))
     {
-        out.write(reinterpret_cast<const char *>(array_data::access(*begin, 0)),
-                  sizeof(data_type) * array_data::dimensions * std::distance(begin, end));
+        observer.begin_data(data_path::contiguous);
+        const std::size_t size = sizeof(data_type) * array_data::dimensions *
+                                 std::distance(begin, end);
+        out.write(reinterpret_cast<const char *>(array_data::access(*begin, 0)), size);
+        observer.sink_write(size);
     }
     else
     {
-        for( ; begin != end; ++begin)
-        {
-            out.write(reinterpret_cast<const char *>(array_data::access(*begin, 0)),
-                      sizeof(data_type) * array_data::dimensions);
-        }
+        observer.begin_data(data_path::per_element);
+        write_staged(out, begin, end, tag, observer);
     }
+    observer.end_data();
 }
 
-template<typename OStream, typename Iter>
-void write_data_impl(OStream &out, Iter begin, Iter end, default_storage_tag)
+template<typename OStream, typename Iter, typename Observer>
+void write_data_impl(OStream &out, Iter begin, Iter end, default_storage_tag tag,
+                     Observer &observer)
 {
-    using array_data = array_data_traits<typename std::iterator_traits<Iter>::value_type>;
-    using data_type = typename array_data::scalar_type;
-
-    for( ; begin != end; ++begin)
-    {
-        //write each coefficient on its own
-        for(std::size_t d = 0; d < array_data::dimensions; ++d)
-        {
-            out.write(reinterpret_cast<const char *>(array_data::access(*begin, d)),
-                      sizeof(data_type));
-        }
-    }
+    observer.begin_data(data_path::per_coefficient);
+    write_staged(out, begin, end, tag, observer);
+    observer.end_data();
 }
 
-template<typename OStream, typename Iter>
-void write_data(OStream &out, Iter begin, Iter end)
+template<typename OStream, typename Iter, typename Observer>
+void write_data(OStream &out, Iter begin, Iter end, Observer &observer)
 {
     using array_data = array_data_traits<typename std::iterator_traits<Iter>::value_type>;
     using storage_tag = typename storage_layout<typename array_data::value_type,
                                                 typename array_data::scalar_type,
                                                 array_data::dimensions>::type;
 
-    write_data_impl(out, begin, end, storage_tag{});
+    write_data_impl(out, begin, end, storage_tag{}, observer);
+}
+
+template<typename OStream, typename Iter>
+void write_data(OStream &out, Iter begin, Iter end)
+{
+    null_observer observer;
+    write_data(out, begin, end, observer);
 }
 
 template<typename Iter>
@@ -388,19 +507,81 @@ constexpr std::size_t dims()
 
 } //namespace detail
 
+//observer for write() accumulating statistics over one or more exports, eg. to find exports
+//that do not take the contiguous data path
+class export_statistics
+{
+public:
+    using duration = std::chrono::duration<double>;
+
+    std::uint64_t exports() const { return exports_; }
+    //number of exports that used the given data path
+    std::uint64_t exports(data_path path) const
+    {
+        return path_count_[static_cast<std::size_t>(path)];
+    }
+    data_path last_data_path() const { return last_path_; }
+
+    std::uint64_t header_bytes() const { return header_bytes_; }
+    std::uint64_t data_bytes() const { return data_bytes_; }
+    std::uint64_t bytes_written() const { return header_bytes_ + data_bytes_; }
+    std::uint64_t sink_calls() const { return sink_calls_; }
 
+    duration header_time() const { return header_time_; }
+    duration data_time() const { return data_time_; }
+
+    //achieved bandwidth in bytes per second (header and data)
+    double bandwidth() const
+    {
+        const auto seconds = (header_time_ + data_time_).count();
+        return seconds > 0 ? bytes_written() / seconds : 0;
+    }
+
+    //observer interface used by write()
+    void begin_header() { ++exports_; in_header_ = true; start_ = clock::now(); }
+    void end_header() { header_time_ += clock::now() - start_; in_header_ = false; }
+    void begin_data(data_path path)
+    {
+        last_path_ = path;
+        ++path_count_[static_cast<std::size_t>(path)];
+        start_ = clock::now();
+    }
+    void end_data() { data_time_ += clock::now() - start_; }
+    void sink_write(std::size_t bytes)
+    {
+        ++sink_calls_;
+        (in_header_ ? header_bytes_ : data_bytes_) += bytes;
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    std::uint64_t exports_ = 0;
+    std::array<std::uint64_t, 3> path_count_ = {{0, 0, 0}};
+    data_path last_path_ = data_path::contiguous;
+    std::uint64_t header_bytes_ = 0;
+    std::uint64_t data_bytes_ = 0;
+    std::uint64_t sink_calls_ = 0;
+    duration header_time_{0};
+    duration data_time_{0};
+    clock::time_point start_;
+    bool in_header_ = false;
+};
+
+//export with an observer (eg. export_statistics) that is notified about header and data writes
 template<typename EndianConv = detail::runtime_byte_order_conversion,
-         typename OStream, typename Iter, typename ShapeDesc>
-void write(OStream &out, Iter begin, Iter end, const ShapeDesc &shape, bool fortran_order = false)
+         typename OStream, typename Observer, typename Iter, typename ShapeDesc>
+void write(OStream &out, Observer &observer, Iter begin, Iter end, const ShapeDesc &shape,
+           bool fortran_order = false)
 {
     assert(out.good());
-    detail::write_header<EndianConv, Iter>(out, shape, fortran_order);
-    detail::write_data(out, begin, end);
+    detail::write_header<EndianConv, Iter>(out, shape, fortran_order, observer);
+    detail::write_data(out, begin, end, observer);
 }
 
 template<typename EndianConv = detail::runtime_byte_order_conversion,
-         typename OStream, typename Iter>
-void write(OStream &out, Iter begin, Iter end)
+         typename OStream, typename Observer, typename Iter>
+void write(OStream &out, Observer &observer, Iter begin, Iter end)
 {
     assert(out.good());
     assert(std::distance(begin, end) >= 0);
@@ -412,7 +593,7 @@ void write(OStream &out, Iter begin, Iter end)
         detail::write_header<EndianConv, Iter>(
                                         out,
                                         shape{{static_cast<std::size_t>(std::distance(begin, end))}},
-                                        fortran_order);
+                                        fortran_order, observer);
     }
     else
     {
@@ -421,9 +602,25 @@ void write(OStream &out, Iter begin, Iter end)
                                         out,
                                         shape{{static_cast<std::size_t>(std::distance(begin, end)),
                                               detail::dims<Iter>()}},
-                                        fortran_order);
+                                        fortran_order, observer);
     }
-    detail::write_data(out, begin, end);
+    detail::write_data(out, begin, end, observer);
+}
+
+template<typename EndianConv = detail::runtime_byte_order_conversion,
+         typename OStream, typename Iter, typename ShapeDesc>
+void write(OStream &out, Iter begin, Iter end, const ShapeDesc &shape, bool fortran_order = false)
+{
+    detail::null_observer observer;
+    write<EndianConv>(out, observer, begin, end, shape, fortran_order);
+}
+
+template<typename EndianConv = detail::runtime_byte_order_conversion,
+         typename OStream, typename Iter>
+void write(OStream &out, Iter begin, Iter end)
+{
+    detail::null_observer observer;
+    write<EndianConv>(out, observer, begin, end);
 }
 
 } //namespace data
@@ -0,0 +1,404 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+// Copyright (C) Norbert Wenzel 2017.
+
+#ifndef NUMPY_DATA_EXTENSION_PARALLEL_LOADER_HPP
+#define NUMPY_DATA_EXTENSION_PARALLEL_LOADER_HPP
+
+#include "numpy_data.hpp"
+#include "sharded_export.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace numpy
+{
+namespace data
+{
+namespace ext
+{
+
+//the information stored in the header of a NPY file
+struct npy_header
+{
+    unsigned version;
+    std::uint64_t data_offset; //the array data starts at this position in the file
+    byte_order order;
+    char type_code;
+    std::size_t item_size;
+    bool fortran_order;
+    std::vector<std::size_t> shape;
+
+    std::uint64_t elements() const
+    {
+        std::uint64_t n = 1;
+        for(const auto s : shape) { n *= s; }
+        return n;
+    }
+};
+
+//one file of a batch load. header is filled by load()
+template<typename T>
+struct load_request
+{
+    std::string path;
+    T *buffer;
+    std::size_t count; //number of T elements available in buffer
+    npy_header header;
+};
+
+namespace detail
+{
+
+class file_descriptor
+{
+public:
+    explicit file_descriptor(const std::string &path)
+        : fd_(::open(path.c_str(), O_RDONLY | O_CLOEXEC))
+    {
+        if(fd_ < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+        }
+    }
+
+    file_descriptor(const file_descriptor&) = delete;
+    file_descriptor& operator=(const file_descriptor&) = delete;
+    ~file_descriptor() { ::close(fd_); }
+
+    int get() const { return fd_; }
+
+private:
+    int fd_;
+};
+
+//reads exactly length bytes unless the file ends before. returns the number of bytes read
+inline std::size_t pread_all(int fd, char *data, std::size_t length, std::uint64_t offset)
+{
+    std::size_t done = 0;
+    while(done < length)
+    {
+        const auto res = ::pread(fd, data + done, length - done,
+                                 static_cast<off_t>(offset + done));
+        if(res < 0)
+        {
+            if(errno == EINTR) { continue; }
+            throw std::system_error(errno, std::generic_category(), "pread failed");
+        }
+        if(res == 0) { break; }
+        done += static_cast<std::size_t>(res);
+    }
+    return done;
+}
+
+inline std::string dict_value(const std::string &dict, const std::string &key, char terminator)
+{
+    const auto key_pos = dict.find("'" + key + "':");
+    if(key_pos == std::string::npos) { throw std::runtime_error("NPY header lacks " + key); }
+    auto begin = key_pos + key.size() + 3;
+    while(begin < dict.size() && dict[begin] == ' ') { ++begin; }
+    const auto end = dict.find(terminator, begin);
+    if(end == std::string::npos) { throw std::runtime_error("Invalid NPY header value " + key); }
+    return dict.substr(begin, end - begin);
+}
+
+//parses the header dictionary, eg. {'descr': '<f8', 'fortran_order': False, 'shape': (3, 4), }
+inline void parse_header_dictionary(const std::string &dict, npy_header &h)
+{
+    const auto descr = dict_value(dict, "descr", ',');
+    if(descr.size() < 4 || descr.front() != '\'' || descr.back() != '\'')
+    {
+        throw std::runtime_error("Unsupported NPY dtype " + descr);
+    }
+    switch(descr[1])
+    {
+    case '<': h.order = byte_order::little_endian; break;
+    case '>': h.order = byte_order::big_endian; break;
+    case '|': //byte order not relevant
+    case '=': h.order = numpy::data::detail::runtime_byte_order_conversion::current_endianness();
+              break;
+    default: throw std::runtime_error("Unsupported NPY dtype " + descr);
+    }
+    h.type_code = descr[2];
+    h.item_size = std::stoul(descr.substr(3, descr.size() - 4));
+
+    const auto fortran_order = dict_value(dict, "fortran_order", ',');
+    if(fortran_order != "True" && fortran_order != "False")
+    {
+        throw std::runtime_error("Invalid NPY fortran_order " + fortran_order);
+    }
+    h.fortran_order = (fortran_order == "True");
+
+    //Python tuple syntax: "()", "(1,)", "(1, 2)"
+    std::istringstream shape{dict_value(dict, "shape", ')')};
+    if(shape.get() != '(') { throw std::runtime_error("Invalid NPY shape"); }
+    h.shape.clear();
+    std::size_t dim;
+    while(shape >> dim)
+    {
+        h.shape.push_back(dim);
+        if(shape.get() != ',') { break; }
+    }
+}
+
+inline npy_header read_header(int fd)
+{
+    npy_header h;
+
+    char preamble[12];
+    const auto preamble_size = pread_all(fd, preamble, sizeof(preamble), 0);
+    if(preamble_size < 10 ||
+       !std::equal(std::begin(numpy::data::detail::magic_header),
+                   std::end(numpy::data::detail::magic_header), preamble,
+                   [](std::int8_t m, char c) { return static_cast<char>(m) == c; }))
+    {
+        throw std::runtime_error("Not a NPY file");
+    }
+
+    h.version = static_cast<unsigned char>(preamble[6]);
+    if(h.version < 1 || h.version > 3) { throw std::runtime_error("Unsupported NPY version"); }
+
+    //version 1 has a 16 bit header length, version 2 and 3 a 32 bit header length (little endian)
+    const std::size_t length_bytes = (h.version == 1 ? 2 : 4);
+    if(preamble_size < 8 + length_bytes) { throw std::runtime_error("Truncated NPY header"); }
+    std::size_t header_len = 0;
+    for(std::size_t i = 0; i < length_bytes; ++i)
+    {
+        header_len |= std::size_t{static_cast<unsigned char>(preamble[8 + i])} << (8 * i);
+    }
+
+    std::string dict(header_len, '\0');
+    if(pread_all(fd, &dict[0], header_len, 8 + length_bytes) != header_len)
+    {
+        throw std::runtime_error("Truncated NPY header");
+    }
+    parse_header_dictionary(dict, h);
+    h.data_offset = 8 + length_bytes + header_len;
+    return h;
+}
+
+template<typename T>
+void check_header(const npy_header &h, std::size_t count, const std::string &path)
+{
+    using array_data = array_data_traits<T>;
+    using scalar_type = typename array_data::scalar_type;
+
+    if(h.type_code != numpy::data::detail::dtype_type_code<scalar_type>() ||
+       h.item_size != sizeof(scalar_type))
+    {
+        throw std::runtime_error("NPY dtype does not match the requested type in " + path);
+    }
+    if(h.order != byte_order::little_endian && h.order != byte_order::big_endian)
+    {
+        throw std::runtime_error("Unknown byte order in " + path);
+    }
+    if(h.elements() != std::uint64_t{count} * array_data::dimensions)
+    {
+        throw std::runtime_error("NPY shape does not match the buffer size for " + path);
+    }
+    //the data is copied as is, so column major order is only the same as row major order if at
+    //most one dimension is larger than 1
+    if(h.fortran_order &&
+       std::count_if(h.shape.cbegin(), h.shape.cend(), [](std::size_t s) { return s > 1; }) > 1)
+    {
+        throw std::runtime_error("Loading fortran_order arrays is not supported for " + path);
+    }
+}
+
+//one contiguous piece of a file read by a single thread
+struct read_task
+{
+    int fd;
+    std::uint64_t offset;
+    char *destination;
+    std::size_t length;
+    std::size_t swap_size; //0 if no byte order conversion is needed
+    const std::string *path;
+};
+
+inline void run_task(const read_task &task)
+{
+    if(pread_all(task.fd, task.destination, task.length, task.offset) != task.length)
+    {
+        throw std::runtime_error("Truncated NPY data in " + *task.path);
+    }
+
+    //convert the byte order while the chunk is still in cache
+    if(task.swap_size > 1)
+    {
+        for(char *p = task.destination; p != task.destination + task.length; p += task.swap_size)
+        {
+            std::reverse(p, p + task.swap_size);
+        }
+    }
+}
+
+//splits the array data into chunks of at most chunk_size bytes (multiples of the scalar size)
+template<typename T>
+void add_tasks(std::vector<read_task> &tasks, int fd, const npy_header &h, T *buffer,
+               std::size_t count, std::size_t chunk_size, const std::string &path)
+{
+    using array_data = array_data_traits<T>;
+    using scalar_type = typename array_data::scalar_type;
+
+    using rte = numpy::data::detail::runtime_byte_order_conversion;
+    const bool swap = (h.order != rte::current_endianness());
+    const std::size_t total = count * sizeof(T);
+    chunk_size = std::max(chunk_size / sizeof(scalar_type), std::size_t{1}) * sizeof(scalar_type);
+
+#ifdef POSIX_FADV_WILLNEED
+    //start reading the whole array data in the background before the chunks are queued, so the
+    //page cache is filled while the threads are started. this is only a hint, errors are ignored
+    ::posix_fadvise(fd, static_cast<off_t>(h.data_offset), static_cast<off_t>(total),
+                    POSIX_FADV_WILLNEED);
+#endif
+
+    char* const destination = reinterpret_cast<char*>(buffer);
+    for(std::size_t pos = 0; pos < total; pos += chunk_size)
+    {
+        tasks.push_back(read_task{fd, h.data_offset + pos, destination + pos,
+                                  std::min(chunk_size, total - pos),
+                                  swap ? sizeof(scalar_type) : 0, std::addressof(path)});
+    }
+}
+
+//all threads take the next chunk until every chunk of every file is read
+inline void run_tasks(const std::vector<read_task> &tasks, unsigned threads)
+{
+    if(threads == 0) { threads = std::max(std::thread::hardware_concurrency(), 1u); }
+    threads = static_cast<unsigned>(std::min<std::size_t>(threads, tasks.size()));
+
+    std::atomic<std::size_t> next_task{0};
+    std::vector<std::exception_ptr> errors(tasks.size());
+    const auto worker = [&]
+    {
+        for(auto idx = next_task++; idx < tasks.size(); idx = next_task++)
+        {
+            try { run_task(tasks[idx]); }
+            catch(...) { errors[idx] = std::current_exception(); }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned i = 1; i < threads; ++i) { pool.emplace_back(worker); }
+    worker();
+    for(auto &t : pool) { t.join(); }
+
+    for(const auto &e : errors)
+    {
+        if(e) { std::rethrow_exception(e); }
+    }
+}
+
+template<typename T>
+void check_loadable()
+{
+    using array_data = array_data_traits<T>;
+    using storage_tag = typename numpy::data::detail::storage_layout<
+                                                    typename array_data::value_type,
+                                                    typename array_data::scalar_type,
+                                                    array_data::dimensions>::type;
+    static_assert(std::is_same<storage_tag, numpy::data::detail::contiguous_storage_tag>::value,
+                  "Loading requires types consisting only of their scalar coefficients.");
+}
+
+} //namespace detail
+
+static constexpr std::size_t default_load_chunk_size = std::size_t{8} << 20;
+
+//reads the header of a NPY file
+inline npy_header read_header(const std::string &path)
+{
+    detail::file_descriptor fd{path};
+    return detail::read_header(fd.get());
+}
+
+//loads many NPY files into caller provided buffers. the array data of all files is split into
+//chunks that are read in parallel with pread by a single set of threads, converting the byte
+//order in the same pass. the kernel is asked to prefetch each file's data (posix_fadvise) before
+//the chunks are read. arrays in fortran_order are rejected unless their memory layout is the same
+//as in C order (at most one dimension larger than 1).
+template<typename T>
+void load(std::vector<load_request<T>> &requests, unsigned threads = 0,
+          std::size_t chunk_size = default_load_chunk_size)
+{
+    detail::check_loadable<T>();
+
+    std::vector<std::unique_ptr<detail::file_descriptor>> files;
+    std::vector<detail::read_task> tasks;
+    for(auto &r : requests)
+    {
+        files.emplace_back(new detail::file_descriptor{r.path});
+        r.header = detail::read_header(files.back()->get());
+        detail::check_header<T>(r.header, r.count, r.path);
+        detail::add_tasks(tasks, files.back()->get(), r.header, r.buffer, r.count, chunk_size,
+                          r.path);
+    }
+    detail::run_tasks(tasks, threads);
+}
+
+//loads a single NPY file into a caller provided buffer of count elements
+template<typename T>
+npy_header load(const std::string &path, T *buffer, std::size_t count, unsigned threads = 0,
+                std::size_t chunk_size = default_load_chunk_size)
+{
+    std::vector<load_request<T>> requests{load_request<T>{path, buffer, count, npy_header{}}};
+    load(requests, threads, chunk_size);
+    return requests.front().header;
+}
+
+//loads all shards written by write_sharded() into one caller provided buffer of count elements,
+//each shard at the position of its first row. all shards are read by a single set of threads
+template<typename T>
+shard_manifest read_sharded(const std::string &manifest_path, T *buffer, std::size_t count,
+                            unsigned threads = 0,
+                            std::size_t chunk_size = default_load_chunk_size)
+{
+    using array_data = array_data_traits<T>;
+
+    auto manifest = read_manifest(manifest_path);
+    std::uint64_t scalars = 1;
+    for(const auto s : manifest.shape) { scalars *= s; }
+    if(manifest.shape.empty() || scalars != std::uint64_t{count} * array_data::dimensions)
+    {
+        throw std::runtime_error("Shard manifest shape does not match the buffer size for " +
+                                 manifest_path);
+    }
+    const std::size_t row_elements = (manifest.shape[0] == 0 ? 0 : count / manifest.shape[0]);
+
+    std::vector<load_request<T>> requests;
+    for(const auto &shard : manifest.shards)
+    {
+        if(shard.first_row + shard.rows > manifest.shape[0])
+        {
+            throw std::runtime_error("Shard " + shard.file + " exceeds the shape in " +
+                                     manifest_path);
+        }
+        requests.push_back(load_request<T>{shard.file, buffer + shard.first_row * row_elements,
+                                           shard.rows * row_elements, npy_header{}});
+    }
+    load(requests, threads, chunk_size);
+    return manifest;
+}
+
+} //namespace ext
+} //namespace data
+} //namespace numpy
+
+#endif //NUMPY_DATA_EXTENSION_PARALLEL_LOADER_HPP
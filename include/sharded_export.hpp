@@ -0,0 +1,348 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+// Copyright (C) Norbert Wenzel 2017.
+
+#ifndef NUMPY_DATA_EXTENSION_SHARDED_EXPORT_HPP
+#define NUMPY_DATA_EXTENSION_SHARDED_EXPORT_HPP
+
+#include "numpy_data.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace numpy
+{
+namespace data
+{
+namespace ext
+{
+
+struct shard_info
+{
+    std::string file;
+    std::size_t first_row;
+    std::size_t rows;
+};
+
+//the logical array described by the manifest of write_sharded()
+struct shard_manifest
+{
+    std::string descr;
+    std::vector<std::size_t> shape;
+    std::vector<shard_info> shards; //file names include the directory of the manifest
+};
+
+namespace detail
+{
+
+inline std::string shard_file_name(const std::string &prefix, std::size_t idx)
+{
+    std::ostringstream name;
+    name << prefix << '.' << std::setw(5) << std::setfill('0') << idx << ".npy";
+    return name.str();
+}
+
+//file names in the manifest are relative to the manifest's directory
+inline std::string base_name(const std::string &path)
+{
+    const auto sep = path.find_last_of('/');
+    return sep == std::string::npos ? path : path.substr(sep + 1);
+}
+
+//quotes a string for JSON. non-ASCII bytes are kept as they are (UTF-8 file names)
+inline std::string json_string(const std::string &s)
+{
+    std::ostringstream out;
+    out << '"';
+    for(const char c : s)
+    {
+        switch(c)
+        {
+        case '"': out << "\\\""; break;
+        case '\\': out << "\\\\"; break;
+        default:
+            if(static_cast<unsigned char>(c) < 0x20)
+            {
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+                    << static_cast<unsigned>(static_cast<unsigned char>(c)) << std::dec;
+            }
+            else
+            {
+                out << c;
+            }
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+//reads the manifest written by write_manifest(). this is not a general JSON parser, it reads the
+//keys in the order they are written
+class manifest_parser
+{
+public:
+    explicit manifest_parser(std::string json) : json_(std::move(json)) {}
+
+    //moves behind the next occurrence of key
+    void expect(const std::string &key)
+    {
+        const auto pos = json_.find("\"" + key + "\":", pos_);
+        if(pos == std::string::npos) { throw std::runtime_error("Shard manifest lacks " + key); }
+        pos_ = pos + key.size() + 3;
+    }
+
+    bool next(char c)
+    {
+        skip_space();
+        if(pos_ < json_.size() && json_[pos_] == c) { ++pos_; return true; }
+        return false;
+    }
+
+    std::size_t number()
+    {
+        skip_space();
+        const auto begin = pos_;
+        while(pos_ < json_.size() && json_[pos_] >= '0' && json_[pos_] <= '9') { ++pos_; }
+        if(begin == pos_) { throw std::runtime_error("Invalid number in shard manifest"); }
+        return static_cast<std::size_t>(std::stoull(json_.substr(begin, pos_ - begin)));
+    }
+
+    std::string string()
+    {
+        if(!next('"')) { throw std::runtime_error("Invalid string in shard manifest"); }
+        std::string s;
+        while(pos_ < json_.size() && json_[pos_] != '"')
+        {
+            char c = json_[pos_++];
+            if(c == '\\' && pos_ < json_.size())
+            {
+                c = json_[pos_++];
+                if(c == 'u')
+                {
+                    //only control characters are escaped this way
+                    if(pos_ + 4 > json_.size()) { break; }
+                    c = static_cast<char>(std::stoul(json_.substr(pos_, 4), nullptr, 16));
+                    pos_ += 4;
+                }
+            }
+            s.push_back(c);
+        }
+        if(!next('"')) { throw std::runtime_error("Unterminated string in shard manifest"); }
+        return s;
+    }
+
+private:
+    void skip_space()
+    {
+        while(pos_ < json_.size() && std::isspace(static_cast<unsigned char>(json_[pos_])))
+        {
+            ++pos_;
+        }
+    }
+
+    std::string json_;
+    std::size_t pos_ = 0;
+};
+
+template<typename T, typename EndianConv>
+void write_manifest(const std::string &path, const std::vector<std::size_t> &shape,
+                    const std::vector<shard_info> &shards)
+{
+    //{"format": "numpy_data.sharded", "version": 1, "descr": "<f8", "fortran_order": false,
+    // "axis": 0, "shape": [1000, 3], "shards": [{"file": "a.00000.npy", "first_row": 0, ...}]}
+    std::ofstream out{path, std::ios::out};
+    out << "{\"format\": \"numpy_data.sharded\", \"version\": 1, \"descr\": \"";
+    numpy::data::detail::write_dtype_description<T, EndianConv>(out);
+    out << "\", \"fortran_order\": false, \"axis\": 0, \"shape\": [";
+    for(std::size_t i = 0; i < shape.size(); ++i) { out << (i > 0 ? ", " : "") << shape[i]; }
+    out << "], \"shards\": [";
+    for(std::size_t i = 0; i < shards.size(); ++i)
+    {
+        out << (i > 0 ? ",\n    " : "\n    ")
+            << "{\"file\": " << json_string(base_name(shards[i].file)) << ", "
+            << "\"first_row\": " << shards[i].first_row << ", "
+            << "\"rows\": " << shards[i].rows << "}";
+    }
+    out << "]}\n";
+
+    out.close();
+    if(!out) { throw std::runtime_error("Cannot write shard manifest " + path); }
+}
+
+template<typename EndianConv, typename RandIter>
+std::vector<shard_info> write_shards(const std::string &prefix, std::size_t rows_per_shard,
+                                     RandIter begin, RandIter end,
+                                     const std::vector<std::size_t> &shape)
+{
+    static_assert(std::is_base_of<std::random_access_iterator_tag,
+                                  typename std::iterator_traits<RandIter>::iterator_category
+                                 >::value,
+                  "Sharded export requires random access iterators.");
+    using array_data = array_data_traits<typename std::iterator_traits<RandIter>::value_type>;
+
+    if(rows_per_shard == 0) { throw std::invalid_argument("Need at least one row per shard."); }
+    if(shape.empty()) { throw std::invalid_argument("Need at least one dimension to shard."); }
+
+    //number of iterator elements per row along axis 0
+    std::size_t row_scalars = 1;
+    for(auto s = std::next(shape.begin()); s != shape.end(); ++s) { row_scalars *= *s; }
+    if(row_scalars % array_data::dimensions != 0)
+    {
+        throw std::invalid_argument("Rows do not consist of whole array elements.");
+    }
+    const std::size_t row_elements = row_scalars / array_data::dimensions;
+    if(shape[0] * row_elements != static_cast<std::size_t>(std::distance(begin, end)))
+    {
+        throw std::invalid_argument("Shape does not match the number of array elements.");
+    }
+
+    std::vector<shard_info> shards;
+    for(std::size_t row = 0; row < shape[0] || shards.empty(); row += rows_per_shard)
+    {
+        shards.push_back(shard_info{shard_file_name(prefix, shards.size()), row,
+                                    std::min(rows_per_shard, shape[0] - row)});
+    }
+
+    //every thread takes the next shard until all are written. shards are independent files, so
+    //there is no synchronization besides the shard counter
+    std::atomic<std::size_t> next_shard{0};
+    std::vector<std::exception_ptr> errors(shards.size());
+    const auto worker = [&]
+    {
+        for(auto idx = next_shard++; idx < shards.size(); idx = next_shard++)
+        {
+            try
+            {
+                const shard_info &shard = shards[idx];
+                std::vector<std::size_t> shard_shape = shape;
+                shard_shape[0] = shard.rows;
+
+                const auto first = begin + static_cast<std::ptrdiff_t>(shard.first_row *
+                                                                       row_elements);
+                const auto last = first + static_cast<std::ptrdiff_t>(shard.rows * row_elements);
+
+                std::ofstream out{shard.file, std::ios::out | std::ios::binary};
+                if(!out) { throw std::runtime_error("Cannot open shard " + shard.file); }
+                numpy::data::write<EndianConv>(out, first, last, shard_shape);
+                out.close();
+                if(!out) { throw std::runtime_error("Cannot write shard " + shard.file); }
+            }
+            catch(...)
+            {
+                errors[idx] = std::current_exception();
+            }
+        }
+    };
+
+    const std::size_t num_threads = std::min<std::size_t>(
+                                        std::max(std::thread::hardware_concurrency(), 1u),
+                                        shards.size());
+    std::vector<std::thread> threads;
+    for(std::size_t i = 1; i < num_threads; ++i) { threads.emplace_back(worker); }
+    worker();
+    for(auto &t : threads) { t.join(); }
+
+    for(const auto &e : errors)
+    {
+        if(e) { std::rethrow_exception(e); }
+    }
+
+    write_manifest<typename array_data::scalar_type, EndianConv>(prefix + ".json", shape, shards);
+    return shards;
+}
+
+} //namespace detail
+
+//reads the manifest <prefix>.json written by write_sharded()
+inline shard_manifest read_manifest(const std::string &path)
+{
+    std::ifstream in{path, std::ios::in};
+    if(!in) { throw std::runtime_error("Cannot open shard manifest " + path); }
+    detail::manifest_parser json{std::string{std::istreambuf_iterator<char>{in},
+                                             std::istreambuf_iterator<char>{}}};
+
+    shard_manifest m;
+    json.expect("format");
+    if(json.string() != "numpy_data.sharded") { throw std::runtime_error("Not a shard manifest"); }
+    json.expect("version");
+    if(json.number() != 1) { throw std::runtime_error("Unsupported shard manifest version"); }
+    json.expect("descr");
+    m.descr = json.string();
+
+    json.expect("shape");
+    if(!json.next('[')) { throw std::runtime_error("Invalid shape in shard manifest"); }
+    while(!json.next(']'))
+    {
+        m.shape.push_back(json.number());
+        json.next(',');
+    }
+
+    const auto sep = path.find_last_of('/');
+    const std::string directory = (sep == std::string::npos ? "" : path.substr(0, sep + 1));
+    json.expect("shards");
+    if(!json.next('[')) { throw std::runtime_error("Invalid shards in shard manifest"); }
+    while(!json.next(']'))
+    {
+        shard_info shard;
+        json.expect("file");
+        shard.file = directory + json.string();
+        json.expect("first_row");
+        shard.first_row = json.number();
+        json.expect("rows");
+        shard.rows = json.number();
+        if(!json.next('}')) { throw std::runtime_error("Invalid shard in shard manifest"); }
+        json.next(',');
+        m.shards.push_back(shard);
+    }
+    return m;
+}
+
+//splits axis 0 of a (C order) array into shard files of rows_per_shard rows each. every shard is
+//a complete NPY file named <prefix>.NNNNN.npy and shards are written in parallel. the manifest
+//<prefix>.json lists dtype, full shape and the row range of each shard, so readers can present
+//the shards as one logical array (read_manifest(), read_sharded() in parallel_loader.hpp).
+template<typename EndianConv = numpy::data::detail::runtime_byte_order_conversion,
+         typename RandIter, typename ShapeDesc>
+std::vector<shard_info> write_sharded(const std::string &prefix, std::size_t rows_per_shard,
+                                      RandIter begin, RandIter end, const ShapeDesc &shape)
+{
+    using shape_value = typename std::decay<decltype(*std::begin(shape))>::type;
+    static_assert(std::is_integral<shape_value>::value, "Shape description requires integer types");
+
+    std::vector<std::size_t> dims;
+    for(const auto s : shape) { dims.push_back(static_cast<std::size_t>(s)); }
+    return detail::write_shards<EndianConv>(prefix, rows_per_shard, begin, end, dims);
+}
+
+template<typename EndianConv = numpy::data::detail::runtime_byte_order_conversion,
+         typename RandIter>
+std::vector<shard_info> write_sharded(const std::string &prefix, std::size_t rows_per_shard,
+                                      RandIter begin, RandIter end)
+{
+    std::vector<std::size_t> dims{static_cast<std::size_t>(std::distance(begin, end))};
+    if(numpy::data::detail::dims<RandIter>() > 1)
+    {
+        dims.push_back(numpy::data::detail::dims<RandIter>());
+    }
+    return detail::write_shards<EndianConv>(prefix, rows_per_shard, begin, end, dims);
+}
+
+} //namespace ext
+} //namespace data
+} //namespace numpy
+
+#endif //NUMPY_DATA_EXTENSION_SHARDED_EXPORT_HPP
@@ -7,7 +7,10 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdint>
 #include <initializer_list>
+#include <list>
+#include <memory>
 #include <vector>
 
 #include <boost/config.hpp>
@@ -19,6 +22,48 @@
 
 using boost::test_tools::output_test_stream;
 
+//exporting only x and y requires writing each coefficient on its own
+struct padded_point { float x, y; bool flag; };
+
+namespace numpy
+{
+namespace data
+{
+
+template<>
+struct array_data_traits<padded_point>
+{
+    using value_type = padded_point;
+    using scalar_type = float;
+    using pointer_type = const float*;
+    static constexpr std::size_t dimensions = 2;
+
+    static pointer_type access(const padded_point &p, const std::size_t idx)
+    {
+        return idx == 0 ? std::addressof(p.x) : std::addressof(p.y);
+    }
+};
+
+} //namespace data
+} //namespace numpy
+
+namespace
+{
+
+//counts the calls to the output stream while the array data is written
+struct data_call_counter
+{
+    void begin_header() {}
+    void end_header() {}
+    void begin_data(numpy::data::data_path) { in_data = true; }
+    void end_data() { in_data = false; }
+    void sink_write(std::size_t) { if(in_data) { ++calls; } }
+
+    bool in_data = false;
+    std::size_t calls = 0;
+};
+
+} //unnamed namespace
 
 BOOST_AUTO_TEST_SUITE(numpy_test)
 
@@ -89,4 +134,62 @@ BOOST_AUTO_TEST_CASE_TEMPLATE(two_dim_array_export, T, arithmetic_types)
     BOOST_CHECK(!out.is_empty(false));
 }
 
+BOOST_AUTO_TEST_CASE(export_statistics_paths)
+{
+    using numpy::data::data_path;
+
+    const std::vector<std::int32_t> vec(10, 1);
+    const std::list<std::int32_t> lst(vec.cbegin(), vec.cend());
+    const std::vector<padded_point> points(10, padded_point{1, 2, false});
+
+    numpy::data::export_statistics stats;
+    output_test_stream out;
+    numpy::data::write(out, stats, vec.cbegin(), vec.cend());
+    BOOST_CHECK(stats.last_data_path() == data_path::contiguous);
+    BOOST_CHECK_EQUAL(stats.data_bytes(), vec.size() * sizeof(std::int32_t));
+    BOOST_CHECK_EQUAL(stats.bytes_written() % 16, stats.data_bytes() % 16);
+    BOOST_CHECK_EQUAL(stats.header_bytes() + stats.data_bytes(), out.str().size());
+
+    output_test_stream out_list;
+    numpy::data::write(out_list, stats, lst.cbegin(), lst.cend());
+    BOOST_CHECK(stats.last_data_path() == data_path::per_element);
+
+    const auto shape = {5, 4};
+    output_test_stream out_points;
+    numpy::data::write(out_points, stats, points.cbegin(), points.cend(), shape);
+    BOOST_CHECK(stats.last_data_path() == data_path::per_coefficient);
+
+    BOOST_CHECK_EQUAL(stats.exports(), 3u);
+    BOOST_CHECK_EQUAL(stats.exports(data_path::contiguous), 1u);
+    BOOST_CHECK_EQUAL(stats.exports(data_path::per_element), 1u);
+    BOOST_CHECK_EQUAL(stats.exports(data_path::per_coefficient), 1u);
+    BOOST_CHECK_EQUAL(stats.data_bytes(), 2 * vec.size() * sizeof(std::int32_t) +
+                                          points.size() * 2 * sizeof(float));
+}
+
+//non-contiguous ranges are collected in the staging buffer and written once per staging_size bytes
+BOOST_AUTO_TEST_CASE(staged_sink_calls)
+{
+    using numpy::data::detail::staging_size;
+
+    const std::list<std::int32_t> small(10, 1);
+    data_call_counter counter;
+    output_test_stream out;
+    numpy::data::write(out, counter, small.cbegin(), small.cend());
+    BOOST_CHECK_EQUAL(counter.calls, 1u);
+
+    const std::size_t bytes = 3 * staging_size + 100;
+    const std::list<std::int32_t> large(bytes / sizeof(std::int32_t), 1);
+    counter = data_call_counter{};
+    output_test_stream out_large;
+    numpy::data::write(out_large, counter, large.cbegin(), large.cend());
+    BOOST_CHECK_EQUAL(counter.calls, (bytes + staging_size - 1) / staging_size);
+
+    const std::vector<padded_point> points(bytes / (2 * sizeof(float)), padded_point{1, 2, false});
+    counter = data_call_counter{};
+    output_test_stream out_points;
+    numpy::data::write(out_points, counter, points.cbegin(), points.cend());
+    BOOST_CHECK_EQUAL(counter.calls, (bytes + staging_size - 1) / staging_size);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,122 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+// Copyright (C) Norbert Wenzel 2017.
+
+#define BOOST_TEST_MODULE export_cache
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <boost/endian/conversion.hpp>
+#include <boost/test/included/unit_test.hpp>
+
+#include "numpy_data.hpp"
+#include "export_cache.hpp"
+
+using xxh64 = numpy::data::ext::detail::xxh64_stream;
+
+
+BOOST_AUTO_TEST_SUITE(numpy_test)
+
+BOOST_AUTO_TEST_CASE(xxh64_reference_values)
+{
+    if(boost::endian::order::native != boost::endian::order::little)
+    {
+        BOOST_TEST_MESSAGE("Reference values are only valid on little endian systems.");
+        return;
+    }
+
+    BOOST_CHECK_EQUAL(xxh64{}.digest(), 0xEF46DB3751D8E999ULL);
+
+    xxh64 abc;
+    abc << std::string{"abc"};
+    BOOST_CHECK_EQUAL(abc.digest(), 0x44BC2CF5AD770999ULL);
+}
+
+BOOST_AUTO_TEST_CASE(xxh64_streaming)
+{
+    std::string data(1000, '\0');
+    std::iota(data.begin(), data.end(), '\0');
+
+    xxh64 whole;
+    whole << data;
+
+    //feed the same data in uneven pieces crossing the stripe boundaries
+    xxh64 pieces;
+    for(std::size_t pos = 0, len = 1; pos < data.size(); pos += len, len = len % 37 + 1)
+    {
+        const auto n = std::min(len, data.size() - pos);
+        pieces.write(data.data() + pos, static_cast<std::streamsize>(n));
+    }
+
+    BOOST_CHECK_EQUAL(whole.size(), data.size());
+    BOOST_CHECK_EQUAL(whole.digest(), pieces.digest());
+}
+
+BOOST_AUTO_TEST_CASE(skip_unchanged_export)
+{
+    const std::string path = "export_cache_test.npy";
+    std::vector<float> data(1000);
+    std::iota(data.begin(), data.end(), 1.0f);
+
+    numpy::data::ext::export_cache cache;
+    BOOST_CHECK(cache.write(path, data.cbegin(), data.cend()));
+    BOOST_CHECK(!cache.write(path, data.cbegin(), data.cend()));
+
+    //changing the payload or only the shape requires a new export
+    data.back() = 0.0f;
+    BOOST_CHECK(cache.write(path, data.cbegin(), data.cend()));
+    const auto shape = {10, 100};
+    BOOST_CHECK(cache.write(path, data.cbegin(), data.cend(), shape));
+    BOOST_CHECK(!cache.write(path, data.cbegin(), data.cend(), shape));
+
+    //a removed file is written again
+    std::remove(path.c_str());
+    BOOST_CHECK(cache.write(path, data.cbegin(), data.cend(), shape));
+
+    cache.forget(path);
+    BOOST_CHECK(cache.write(path, data.cbegin(), data.cend(), shape));
+    std::remove(path.c_str());
+}
+
+//another writer replacing the file with content of the same size forces a new export
+BOOST_AUTO_TEST_CASE(replaced_file)
+{
+    const std::string path = "export_cache_replaced.npy";
+    const std::string other = "export_cache_other.npy";
+    const std::vector<std::int32_t> data(100, 1);
+    const std::vector<std::int32_t> foreign(100, 2);
+
+    numpy::data::ext::export_cache cache;
+    BOOST_CHECK(cache.write(path, data.cbegin(), data.cend()));
+
+    //replaced by renaming another file (new inode)
+    {
+        std::ofstream out{other, std::ios::out | std::ios::binary};
+        numpy::data::write(out, foreign.cbegin(), foreign.cend());
+    }
+    BOOST_REQUIRE(std::rename(other.c_str(), path.c_str()) == 0);
+    BOOST_CHECK(cache.write(path, data.cbegin(), data.cend()));
+    BOOST_CHECK(!cache.write(path, data.cbegin(), data.cend()));
+
+    //overwritten in place (same inode, different modification time)
+    {
+        std::ofstream out{path, std::ios::out | std::ios::binary};
+        numpy::data::write(out, foreign.cbegin(), foreign.cend());
+    }
+    const timespec times[2] = {{0, UTIME_OMIT}, {1000000000, 0}};
+    BOOST_REQUIRE(::utimensat(AT_FDCWD, path.c_str(), times, 0) == 0);
+    BOOST_CHECK(cache.write(path, data.cbegin(), data.cend()));
+    BOOST_CHECK(!cache.write(path, data.cbegin(), data.cend()));
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,351 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+// Copyright (C) Norbert Wenzel 2017.
+
+#define BOOST_TEST_MODULE format_conformance
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/mpl/list.hpp>
+#include <boost/test/included/unit_test.hpp>
+
+#include "numpy_data.hpp"
+
+//a block of 8 KiB exported as one row of a two-dimensional array
+struct row_block { double values[1024]; };
+
+namespace numpy
+{
+namespace data
+{
+
+template<>
+struct array_data_traits<row_block>
+{
+    using value_type = row_block;
+    using scalar_type = double;
+    using pointer_type = const double*;
+    static constexpr std::size_t dimensions = 1024;
+
+    static pointer_type access(const row_block &b, const std::size_t idx)
+    {
+        return std::addressof(b.values[idx]);
+    }
+};
+
+} //namespace data
+} //namespace numpy
+
+namespace
+{
+
+//random access iterator returning the same element at every position, so huge arrays can be
+//exported without the memory to hold them
+template<typename T>
+class repeat_iterator : public std::iterator<std::random_access_iterator_tag, T, std::ptrdiff_t,
+                                             const T*, const T&>
+{
+public:
+    repeat_iterator(const T &value, std::ptrdiff_t pos) : value_(std::addressof(value)), pos_(pos) {}
+
+    const T& operator*() const { return *value_; }
+    repeat_iterator& operator++() { ++pos_; return *this; }
+    repeat_iterator& operator--() { --pos_; return *this; }
+    repeat_iterator operator+(std::ptrdiff_t n) const { return {*value_, pos_ + n}; }
+    repeat_iterator operator-(std::ptrdiff_t n) const { return {*value_, pos_ - n}; }
+    std::ptrdiff_t operator-(const repeat_iterator &o) const { return pos_ - o.pos_; }
+    bool operator==(const repeat_iterator &o) const { return pos_ == o.pos_; }
+    bool operator!=(const repeat_iterator &o) const { return pos_ != o.pos_; }
+
+private:
+    const T *value_;
+    std::ptrdiff_t pos_;
+};
+
+//output stream only keeping the first bytes (ie. the header) but counting everything
+class prefix_sink
+{
+public:
+    explicit prefix_sink(std::size_t keep) : keep_(keep) {}
+
+    prefix_sink& write(const char *data, std::streamsize count)
+    {
+        const auto n = static_cast<std::size_t>(count);
+        if(prefix_.size() < keep_) { prefix_.append(data, std::min(n, keep_ - prefix_.size())); }
+        position_ += count;
+        return *this;
+    }
+
+    prefix_sink& put(char c) { return write(&c, 1); }
+
+    prefix_sink& operator<<(const std::string &s)
+    {
+        return write(s.data(), static_cast<std::streamsize>(s.size()));
+    }
+
+    std::streamoff tellp() const { return position_; }
+    bool good() const { return true; }
+    const std::string& prefix() const { return prefix_; }
+
+private:
+    std::size_t keep_;
+    std::string prefix_;
+    std::streamoff position_ = 0;
+};
+
+struct parsed_header
+{
+    unsigned version;
+    std::size_t length; //number of bytes before the array data
+    std::string descr;
+    bool fortran_order;
+    std::vector<std::size_t> shape;
+};
+
+std::string dict_value(const std::string &dict, const std::string &key, char terminator)
+{
+    const auto key_pos = dict.find("'" + key + "': ");
+    BOOST_REQUIRE(key_pos != std::string::npos);
+    const auto begin = key_pos + key.size() + 4;
+    const auto end = dict.find(terminator, begin);
+    BOOST_REQUIRE(end != std::string::npos);
+    return dict.substr(begin, end - begin);
+}
+
+//parses and validates the header independently of the exporter
+parsed_header parse_header(const std::string &npy)
+{
+    parsed_header h;
+    BOOST_REQUIRE(npy.size() >= 10);
+    BOOST_REQUIRE(npy.compare(0, 6, "\x93NUMPY") == 0);
+    h.version = static_cast<unsigned char>(npy[6]);
+    BOOST_REQUIRE(h.version >= 1 && h.version <= 3);
+    BOOST_REQUIRE_EQUAL(npy[7], 0);
+
+    //version 1 has a 16 bit header length, version 2 and 3 a 32 bit header length
+    const std::size_t length_bytes = (h.version == 1 ? 2 : 4);
+    std::size_t header_len = 0;
+    for(std::size_t i = 0; i < length_bytes; ++i)
+    {
+        header_len |= std::size_t{static_cast<unsigned char>(npy[8 + i])} << (8 * i);
+    }
+    h.length = 8 + length_bytes + header_len;
+    BOOST_REQUIRE(npy.size() >= h.length);
+    BOOST_CHECK_EQUAL(h.length % 16, 0u);
+    BOOST_CHECK_EQUAL(npy[h.length - 1], '\n');
+
+    const std::string dict = npy.substr(8 + length_bytes, header_len);
+    //plain ASCII is valid latin1 (version 1 and 2) as well as UTF-8 (version 3)
+    BOOST_CHECK(std::all_of(dict.begin(), dict.end(),
+                            [](char c) { return c > 0 && static_cast<unsigned char>(c) < 128; }));
+    BOOST_REQUIRE(dict.front() == '{' && dict.find('}') != std::string::npos);
+
+    h.descr = dict_value(dict, "descr", ',');
+    BOOST_REQUIRE(h.descr.size() >= 2 && h.descr.front() == '\'' && h.descr.back() == '\'');
+    h.descr = h.descr.substr(1, h.descr.size() - 2);
+
+    const auto fortran_order = dict_value(dict, "fortran_order", ',');
+    BOOST_REQUIRE(fortran_order == "True" || fortran_order == "False");
+    h.fortran_order = (fortran_order == "True");
+
+    std::istringstream shape{dict_value(dict, "shape", ')')};
+    BOOST_REQUIRE_EQUAL(shape.get(), '(');
+    //Python tuple syntax: "(1,)", "(1, 2)"
+    std::size_t dim;
+    while(shape >> dim)
+    {
+        h.shape.push_back(dim);
+        const auto separator = shape.get();
+        BOOST_REQUIRE(separator == ',' || separator == std::istringstream::traits_type::eof());
+    }
+    BOOST_REQUIRE(!h.shape.empty());
+    return h;
+}
+
+template<typename T>
+std::string expected_descr()
+{
+    std::ostringstream descr;
+    using rte = numpy::data::detail::runtime_byte_order_conversion;
+    numpy::data::detail::write_dtype_description<T, rte>(descr);
+    return descr.str();
+}
+
+void report(const std::string &name, const numpy::data::export_statistics &stats)
+{
+    BOOST_TEST_MESSAGE(name << ": " << stats.exports() << " exports, "
+                       << stats.bytes_written() << " bytes, "
+                       << stats.bandwidth() * 1e-9 << " GB/s");
+}
+
+} //unnamed namespace
+
+
+BOOST_AUTO_TEST_SUITE(numpy_test)
+
+typedef boost::mpl::list<std::int8_t,  std::int16_t,  std::int32_t,  std::int64_t,
+                         std::uint8_t, std::uint16_t, std::uint32_t, std::uint64_t,
+                         bool, float, double> arithmetic_types;
+BOOST_AUTO_TEST_CASE_TEMPLATE(version1_roundtrip, T, arithmetic_types)
+{
+    //not std::vector, which is specialized for bool
+    std::array<T, 7> data;
+    data.fill(T(1));
+
+    numpy::data::export_statistics stats;
+    std::ostringstream out;
+    numpy::data::write(out, stats, data.cbegin(), data.cend());
+    const auto npy = out.str();
+    const auto h = parse_header(npy);
+
+    BOOST_CHECK_EQUAL(h.version, 1u);
+    BOOST_CHECK_EQUAL(h.descr, expected_descr<T>());
+    BOOST_CHECK(!h.fortran_order);
+    BOOST_CHECK(h.shape == std::vector<std::size_t>{data.size()});
+    BOOST_CHECK_EQUAL(npy.size() - h.length, data.size() * sizeof(T));
+    BOOST_CHECK_EQUAL(stats.header_bytes(), h.length);
+    BOOST_CHECK(stats.last_data_path() == numpy::data::data_path::contiguous);
+    report("version 1 roundtrip " + expected_descr<T>(), stats);
+}
+
+BOOST_AUTO_TEST_CASE(high_rank_shapes)
+{
+    const std::int32_t value = 42;
+    numpy::data::export_statistics stats;
+    for(const std::size_t rank : {2, 16, 32, 64})
+    {
+        std::vector<std::size_t> shape(rank, 1);
+        shape.front() = 2;
+
+        std::ostringstream out;
+        numpy::data::write(out, stats, repeat_iterator<std::int32_t>{value, 0},
+                           repeat_iterator<std::int32_t>{value, 2}, shape, true);
+        const auto h = parse_header(out.str());
+        BOOST_CHECK_EQUAL(h.version, 1u);
+        BOOST_CHECK(h.fortran_order);
+        BOOST_CHECK(h.shape == shape);
+        BOOST_CHECK_EQUAL(out.str().size() - h.length, 2 * sizeof(std::int32_t));
+    }
+    BOOST_CHECK_EQUAL(stats.exports(), 4u);
+    BOOST_CHECK_EQUAL(stats.data_bytes(), 4 * 2 * sizeof(std::int32_t));
+    report("high rank shapes", stats);
+}
+
+//sweep the header dictionary length over the largest version 1 header. the exporter has to switch
+//to version 2 exactly when the padded version 1 header does not fit into 16 bit any more. the
+//dictionary is always ASCII, so the UTF-8 version 3 is never required.
+BOOST_AUTO_TEST_CASE(version2_boundary)
+{
+    const std::uint8_t value = 1;
+    numpy::data::export_statistics stats;
+    bool seen_v1 = false;
+    bool seen_v2 = false;
+
+    //every one dimension adds 3 characters ("1, "), the first dimension 0, 1 or 2 more
+    for(std::size_t rank = 21815; rank < 21830; ++rank)
+    {
+        for(const std::size_t first : {1, 10, 100})
+        {
+            std::vector<std::size_t> shape(rank, 1);
+            shape.front() = first;
+
+            prefix_sink out{std::numeric_limits<std::uint16_t>::max() + 1024u};
+            numpy::data::write(out, stats, repeat_iterator<std::uint8_t>{value, 0},
+                               repeat_iterator<std::uint8_t>{value,
+                                                             static_cast<std::ptrdiff_t>(first)},
+                               shape);
+            const auto h = parse_header(out.prefix());
+            BOOST_CHECK(h.shape == shape);
+            BOOST_CHECK_EQUAL(static_cast<std::size_t>(out.tellp()) - h.length, first);
+
+            //length of the unpadded dictionary and of the header if it was written as version 1
+            const std::size_t dict_len = out.prefix().find('}', 10) + 1 - (h.version == 1 ? 10 : 12);
+            const std::size_t v1_len = (10 + dict_len + 1 + 15) / 16 * 16 - 10;
+            const bool fits_v1 = v1_len <= std::numeric_limits<std::uint16_t>::max();
+            BOOST_CHECK_EQUAL(h.version, fits_v1 ? 1u : 2u);
+            seen_v1 = seen_v1 || h.version == 1;
+            seen_v2 = seen_v2 || h.version == 2;
+        }
+    }
+    BOOST_CHECK(seen_v1 && seen_v2);
+    report("version 2 boundary", stats);
+}
+
+//more than 4 GiB of data, so any 32 bit size computation would overflow
+BOOST_AUTO_TEST_CASE(payload_larger_than_4gb)
+{
+    row_block block;
+    std::fill(std::begin(block.values), std::end(block.values), 1.0);
+    const std::size_t rows = (std::uint64_t{1} << 32) / sizeof(row_block) + 3;
+
+    numpy::data::export_statistics stats;
+    prefix_sink out{4096};
+    numpy::data::write(out, stats, repeat_iterator<row_block>{block, 0},
+                       repeat_iterator<row_block>{block, static_cast<std::ptrdiff_t>(rows)});
+
+    const auto h = parse_header(out.prefix());
+    BOOST_CHECK_EQUAL(h.descr, expected_descr<double>());
+    BOOST_CHECK(h.shape == (std::vector<std::size_t>{rows, 1024}));
+    BOOST_CHECK(stats.last_data_path() == numpy::data::data_path::per_element);
+    BOOST_CHECK_EQUAL(stats.data_bytes(), std::uint64_t{rows} * sizeof(row_block));
+    BOOST_CHECK_EQUAL(static_cast<std::uint64_t>(out.tellp()), h.length + stats.data_bytes());
+    BOOST_CHECK_GT(stats.data_bytes(), std::numeric_limits<std::uint32_t>::max());
+    report("payload > 4 GiB", stats);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_exports)
+{
+    static constexpr std::size_t num_threads = 16;
+    static constexpr std::size_t exports_per_thread = 8;
+    static constexpr std::size_t elements = 1 << 16;
+
+    std::vector<numpy::data::export_statistics> stats(num_threads);
+    std::vector<std::string> headers(num_threads);
+    std::vector<char> valid(num_threads, false);
+    std::vector<std::thread> threads;
+    for(std::size_t t = 0; t < num_threads; ++t)
+    {
+        threads.emplace_back([t, &stats, &headers, &valid]
+        {
+            const std::vector<double> data(elements, static_cast<double>(t));
+            bool ok = true;
+            for(std::size_t i = 0; i < exports_per_thread; ++i)
+            {
+                std::ostringstream out;
+                numpy::data::write(out, stats[t], data.cbegin(), data.cend());
+                const auto npy = out.str();
+                //no Boost.Test assertions in threads, only compare the payload here
+                ok = ok && npy.size() > elements * sizeof(double) &&
+                     npy.compare(npy.size() - elements * sizeof(double), std::string::npos,
+                                 reinterpret_cast<const char*>(data.data()),
+                                 elements * sizeof(double)) == 0;
+                headers[t] = npy.substr(0, npy.size() - elements * sizeof(double));
+            }
+            valid[t] = ok;
+        });
+    }
+    for(auto &t : threads) { t.join(); }
+
+    for(std::size_t t = 0; t < num_threads; ++t)
+    {
+        BOOST_CHECK(valid[t]);
+        const auto h = parse_header(headers[t]);
+        BOOST_CHECK_EQUAL(h.length, headers[t].size());
+        BOOST_CHECK(h.shape == std::vector<std::size_t>{elements});
+        BOOST_CHECK_EQUAL(stats[t].exports(), exports_per_thread);
+        BOOST_CHECK_EQUAL(stats[t].data_bytes(), exports_per_thread * elements * sizeof(double));
+        report("thread " + std::to_string(t), stats[t]);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
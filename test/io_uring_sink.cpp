@@ -0,0 +1,128 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+// Copyright (C) Norbert Wenzel 2017.
+
+#define BOOST_TEST_MODULE io_uring_sink
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <boost/mpl/list.hpp>
+#include <boost/test/included/unit_test.hpp>
+
+#include "numpy_data.hpp"
+#include "io_uring_sink.hpp"
+
+namespace
+{
+
+std::string read_file(const std::string &path)
+{
+    std::ifstream in{path, std::ios::in | std::ios::binary};
+    return std::string{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+}
+
+template<typename Iter>
+std::string reference_export(Iter begin, Iter end)
+{
+    std::ostringstream out{std::ios::out | std::ios::binary};
+    numpy::data::write(out, begin, end);
+    return out.str();
+}
+
+} //unnamed namespace
+
+BOOST_AUTO_TEST_SUITE(numpy_test)
+
+//both backends have to produce byte identical files
+typedef boost::mpl::list<std::true_type, std::false_type> backends;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(small_export, AllowRing, backends)
+{
+    const std::string path = "io_uring_sink_small.npy";
+    const std::vector<std::int32_t> data = {1, 2, 3, 4, 5, 6};
+    {
+        numpy::data::ext::io_uring_sink out{path, 4096, 4, AllowRing::value};
+        numpy::data::write(out, data.cbegin(), data.cend());
+        out.close();
+    }
+    BOOST_CHECK(read_file(path) == reference_export(data.cbegin(), data.cend()));
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(multi_block_export, AllowRing, backends)
+{
+    const std::string path = "io_uring_sink_large.npy";
+    //odd block size forces writes spanning block boundaries and all blocks being in flight
+    std::vector<double> data(100003);
+    std::iota(data.begin(), data.end(), 0.5);
+    {
+        numpy::data::ext::io_uring_sink out{path, 4099, 3, AllowRing::value};
+        BOOST_TEST_MESSAGE("io_uring in use: " << out.uses_io_uring());
+        numpy::data::write(out, data.cbegin(), data.cend());
+        BOOST_CHECK_EQUAL(static_cast<std::size_t>(out.tellp()),
+                          reference_export(data.cbegin(), data.cend()).size());
+    } //destructor flushes the remaining block
+    BOOST_CHECK(read_file(path) == reference_export(data.cbegin(), data.cend()));
+    std::remove(path.c_str());
+}
+
+//many files share the blocks of one writer. more files than blocks are open at the same time, so
+//blocks of files which were not flushed have to be written out for other files
+BOOST_AUTO_TEST_CASE_TEMPLATE(shared_writer_export, AllowRing, backends)
+{
+    const std::size_t num_files = 20;
+    numpy::data::ext::io_uring_writer writer{4096, 4, AllowRing::value};
+    BOOST_TEST_MESSAGE("io_uring in use: " << writer.uses_io_uring());
+
+    std::vector<std::vector<std::int64_t>> data;
+    std::vector<std::unique_ptr<numpy::data::ext::io_uring_sink>> sinks;
+    for(std::size_t i = 0; i < num_files; ++i)
+    {
+        data.emplace_back(100 * i + 1);
+        std::iota(data.back().begin(), data.back().end(), static_cast<std::int64_t>(i));
+        const auto path = "io_uring_sink_shared" + std::to_string(i) + ".npy";
+        sinks.emplace_back(new numpy::data::ext::io_uring_sink{writer, path});
+        numpy::data::write(*sinks.back(), data.back().cbegin(), data.back().cend());
+        if(i % 2 == 0) { sinks.back()->flush(); }
+    }
+
+    writer.wait_all();
+    for(std::size_t i = 0; i < num_files; ++i)
+    {
+        sinks[i]->close();
+        const auto path = "io_uring_sink_shared" + std::to_string(i) + ".npy";
+        BOOST_CHECK(read_file(path) == reference_export(data[i].cbegin(), data[i].cend()));
+        std::remove(path.c_str());
+    }
+}
+
+//a failing write has to be reported by close() and must neither hang nor leak the file
+BOOST_AUTO_TEST_CASE_TEMPLATE(failing_write, AllowRing, backends)
+{
+    const std::vector<double> data(10, 1.0);
+    {
+        numpy::data::ext::io_uring_sink out{"/dev/full", 4096, 4, AllowRing::value};
+        numpy::data::write(out, data.cbegin(), data.cend());
+        BOOST_CHECK_THROW(out.close(), std::system_error);
+        BOOST_CHECK(!out.good());
+    }
+    {
+        //more data than blocks, so the error occurs while writing. the destructor closes the file
+        const std::vector<double> large(4096, 1.0);
+        numpy::data::ext::io_uring_sink out{"/dev/full", 4096, 2, AllowRing::value};
+        BOOST_CHECK_THROW(numpy::data::write(out, large.cbegin(), large.cend()),
+                          std::system_error);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
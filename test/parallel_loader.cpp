@@ -0,0 +1,141 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+// Copyright (C) Norbert Wenzel 2017.
+
+#define BOOST_TEST_MODULE parallel_loader
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/endian/conversion.hpp>
+#include <boost/test/included/unit_test.hpp>
+
+#include "numpy_data.hpp"
+#include "parallel_loader.hpp"
+
+namespace
+{
+
+template<typename EndianConv = numpy::data::detail::runtime_byte_order_conversion,
+         typename Container, typename ShapeDesc>
+void export_file(const std::string &path, const Container &c, const ShapeDesc &shape,
+                 bool fortran_order = false)
+{
+    std::ofstream out{path, std::ios::out | std::ios::binary};
+    numpy::data::write<EndianConv>(out, c.cbegin(), c.cend(), shape, fortran_order);
+}
+
+} //unnamed namespace
+
+BOOST_AUTO_TEST_SUITE(numpy_test)
+
+BOOST_AUTO_TEST_CASE(load_single_file)
+{
+    const std::string path = "parallel_loader_single.npy";
+    std::vector<double> data(100001);
+    std::iota(data.begin(), data.end(), 0.25);
+    const std::size_t shape[] = {data.size()};
+    export_file(path, data, shape);
+
+    //small chunks, so the data is split across all threads
+    std::vector<double> loaded(data.size());
+    const auto h = numpy::data::ext::load(path, loaded.data(), loaded.size(), 4, 4096);
+    BOOST_CHECK(loaded == data);
+    BOOST_CHECK_EQUAL(h.type_code, 'f');
+    BOOST_CHECK_EQUAL(h.item_size, sizeof(double));
+    BOOST_CHECK(h.shape == std::vector<std::size_t>{data.size()});
+
+    std::vector<float> wrong_type(data.size());
+    BOOST_CHECK_THROW(numpy::data::ext::load(path, wrong_type.data(), wrong_type.size()),
+                      std::runtime_error);
+    BOOST_CHECK_THROW(numpy::data::ext::load(path, loaded.data(), loaded.size() - 1),
+                      std::runtime_error);
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(load_foreign_byte_order)
+{
+    namespace be = boost::endian;
+    const std::string path = "parallel_loader_foreign.npy";
+
+    std::vector<std::int32_t> data(1000);
+    std::iota(data.begin(), data.end(), -500);
+
+    //export byte swapped data and mark it with the byte order which is not native on this system
+    std::vector<std::int32_t> foreign(data);
+    for(auto &d : foreign) { be::endian_reverse_inplace(d); }
+    const std::size_t shape[] = {10, 100};
+    export_file(path, foreign, shape);
+    {
+        std::fstream file{path, std::ios::in | std::ios::out | std::ios::binary};
+        std::string header(64, '\0');
+        file.read(&header[0], header.size());
+        const auto pos = header.find("'descr': '") + 10;
+        BOOST_REQUIRE(header[pos] == '<' || header[pos] == '>');
+        file.seekp(static_cast<std::streamoff>(pos));
+        file.put(header[pos] == '<' ? '>' : '<');
+    }
+
+    std::vector<std::int32_t> loaded(data.size());
+    const auto h = numpy::data::ext::load(path, loaded.data(), loaded.size(), 3, 64);
+    BOOST_CHECK(loaded == data);
+    BOOST_CHECK(h.shape == (std::vector<std::size_t>{10, 100}));
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(load_fortran_order)
+{
+    const std::string path = "parallel_loader_fortran.npy";
+    std::vector<float> data(1000);
+    std::iota(data.begin(), data.end(), 1.5f);
+    std::vector<float> loaded(data.size());
+
+    //a column vector has the same layout in both orders
+    const std::size_t column[] = {data.size(), 1};
+    export_file(path, data, column, true);
+    const auto h = numpy::data::ext::load(path, loaded.data(), loaded.size());
+    BOOST_CHECK(h.fortran_order);
+    BOOST_CHECK(loaded == data);
+
+    const std::size_t matrix[] = {10, 100};
+    export_file(path, data, matrix, true);
+    BOOST_CHECK_THROW(numpy::data::ext::load(path, loaded.data(), loaded.size()),
+                      std::runtime_error);
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(load_batch)
+{
+    using request = numpy::data::ext::load_request<std::uint16_t>;
+
+    std::vector<std::vector<std::uint16_t>> data;
+    std::vector<std::vector<std::uint16_t>> loaded;
+    std::vector<request> requests;
+    for(std::size_t i = 0; i < 5; ++i)
+    {
+        data.emplace_back(1000 * (i + 1));
+        std::iota(data.back().begin(), data.back().end(), static_cast<std::uint16_t>(i));
+        const std::size_t shape[] = {data.back().size()};
+        const auto path = "parallel_loader_batch" + std::to_string(i) + ".npy";
+        export_file(path, data.back(), shape);
+
+        loaded.emplace_back(data.back().size());
+        requests.push_back(request{path, loaded.back().data(), loaded.back().size(), {}});
+    }
+
+    numpy::data::ext::load(requests, 4, 1000);
+    for(std::size_t i = 0; i < requests.size(); ++i)
+    {
+        BOOST_CHECK(loaded[i] == data[i]);
+        BOOST_CHECK_EQUAL(requests[i].header.elements(), data[i].size());
+        std::remove(requests[i].path.c_str());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
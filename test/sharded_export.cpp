@@ -0,0 +1,148 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+// Copyright (C) Norbert Wenzel 2017.
+
+#define BOOST_TEST_MODULE sharded_export
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/test/included/unit_test.hpp>
+
+#include "numpy_data.hpp"
+#include "sharded_export.hpp"
+#include "parallel_loader.hpp"
+
+namespace
+{
+
+std::string read_file(const std::string &path)
+{
+    std::ifstream in{path, std::ios::in | std::ios::binary};
+    return std::string{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+}
+
+//the payload starts after the header, whose length is stored in bytes 8 and 9 (version 1)
+std::string payload(const std::string &npy)
+{
+    BOOST_REQUIRE(npy.size() >= 10 && npy[6] == 1);
+    const auto header_len = static_cast<unsigned char>(npy[8]) +
+                            (static_cast<unsigned char>(npy[9]) << 8);
+    return npy.substr(10 + header_len);
+}
+
+} //unnamed namespace
+
+BOOST_AUTO_TEST_SUITE(numpy_test)
+
+BOOST_AUTO_TEST_CASE(shards_cover_whole_array)
+{
+    const std::string prefix = "sharded_export_test";
+    std::vector<double> data(1003 * 3);
+    std::iota(data.begin(), data.end(), 0.0);
+
+    const std::size_t shape[] = {1003, 3};
+    const auto shards = numpy::data::ext::write_sharded(prefix, 100, data.cbegin(), data.cend(),
+                                                        shape);
+    BOOST_REQUIRE_EQUAL(shards.size(), 11u);
+    BOOST_CHECK_EQUAL(shards.back().first_row, 1000u);
+    BOOST_CHECK_EQUAL(shards.back().rows, 3u);
+
+    std::string joined;
+    for(const auto &shard : shards)
+    {
+        const auto npy = read_file(shard.file);
+        const auto expected_shape = "'shape': (" + std::to_string(shard.rows) + ", 3)";
+        BOOST_CHECK(npy.find(expected_shape) != std::string::npos);
+        joined += payload(npy);
+        std::remove(shard.file.c_str());
+    }
+    BOOST_CHECK(joined == std::string(reinterpret_cast<const char*>(data.data()),
+                                      data.size() * sizeof(double)));
+
+    const auto manifest = read_file(prefix + ".json");
+    BOOST_CHECK(manifest.find("\"shape\": [1003, 3]") != std::string::npos);
+    BOOST_CHECK(manifest.find("{\"file\": \"sharded_export_test.00010.npy\", "
+                              "\"first_row\": 1000, \"rows\": 3}") != std::string::npos);
+    std::remove((prefix + ".json").c_str());
+}
+
+//the manifest is enough to read the shards back as one array
+BOOST_AUTO_TEST_CASE(read_through_manifest)
+{
+    const std::string prefix = "sharded_export_read";
+    std::vector<float> data(257 * 4);
+    std::iota(data.begin(), data.end(), 0.5f);
+
+    const std::size_t shape[] = {257, 4};
+    const auto shards = numpy::data::ext::write_sharded(prefix, 50, data.cbegin(), data.cend(),
+                                                        shape);
+
+    std::vector<float> loaded(data.size());
+    const auto manifest = numpy::data::ext::read_sharded(prefix + ".json", loaded.data(),
+                                                         loaded.size(), 3);
+    BOOST_CHECK(loaded == data);
+    BOOST_CHECK(manifest.shape == (std::vector<std::size_t>{257, 4}));
+    BOOST_REQUIRE_EQUAL(manifest.shards.size(), shards.size());
+    for(std::size_t i = 0; i < shards.size(); ++i)
+    {
+        BOOST_CHECK_EQUAL(manifest.shards[i].file, shards[i].file);
+        BOOST_CHECK_EQUAL(manifest.shards[i].first_row, shards[i].first_row);
+        BOOST_CHECK_EQUAL(manifest.shards[i].rows, shards[i].rows);
+    }
+
+    std::vector<float> too_small(data.size() - 4);
+    BOOST_CHECK_THROW(numpy::data::ext::read_sharded(prefix + ".json", too_small.data(),
+                                                     too_small.size()),
+                      std::runtime_error);
+
+    for(const auto &shard : shards) { std::remove(shard.file.c_str()); }
+    std::remove((prefix + ".json").c_str());
+}
+
+BOOST_AUTO_TEST_CASE(default_shape)
+{
+    const std::string prefix = "sharded_export_default";
+    const std::vector<int> data(10, 7);
+
+    const auto shards = numpy::data::ext::write_sharded(prefix, 4, data.cbegin(), data.cend());
+    BOOST_REQUIRE_EQUAL(shards.size(), 3u);
+    BOOST_CHECK(read_file(shards[1].file).find("'shape': (4,)") != std::string::npos);
+
+    for(const auto &shard : shards) { std::remove(shard.file.c_str()); }
+    std::remove((prefix + ".json").c_str());
+}
+
+BOOST_AUTO_TEST_CASE(escaped_file_names)
+{
+    const std::string prefix = "sharded_export_\"quoted\\name";
+    const std::vector<int> data(4, 1);
+
+    const auto shards = numpy::data::ext::write_sharded(prefix, 4, data.cbegin(), data.cend());
+    BOOST_REQUIRE_EQUAL(shards.size(), 1u);
+    const auto manifest = read_file(prefix + ".json");
+    BOOST_CHECK(manifest.find("{\"file\": \"sharded_export_\\\"quoted\\\\name.00000.npy\", "
+                              "\"first_row\": 0, \"rows\": 4}") != std::string::npos);
+    BOOST_CHECK_EQUAL(numpy::data::ext::read_manifest(prefix + ".json").shards.front().file,
+                      shards.front().file);
+
+    std::remove(shards.front().file.c_str());
+    std::remove((prefix + ".json").c_str());
+}
+
+BOOST_AUTO_TEST_CASE(shape_mismatch)
+{
+    const std::vector<int> data(10);
+    const std::size_t shape[] = {3, 3};
+    BOOST_CHECK_THROW(numpy::data::ext::write_sharded("sharded_export_invalid", 1,
+                                                      data.cbegin(), data.cend(), shape),
+                      std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()